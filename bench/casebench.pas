@@ -0,0 +1,54 @@
+program casebench(output);
+{ The dispatch of case statements: compile with -n1, -n2 and -n3
+  in turn, run each under dispak and compare the instructions
+  executed. The sums printed must agree between the strategies.
+    dense   - 16 labels in a row, a table for any strategy but -n2
+    sparse  - 12 labels spread over 0..1000
+    halves  - 8 labels, every other value
+    chars   - a character selector, 10 labels }
+const rounds = 20000;
+type color = (red, orange, yellow, green, cyan, blue, violet, black,
+              white, grey, brown, pink, gold, silver, olive, navy);
+var i, n, dense, sparse, halves, chars: integer;
+    k: color; c: char;
+begin
+  dense := 0; sparse := 0; halves := 0; chars := 0;
+  for i := 1 to rounds do begin
+    k := color(i mod 16);
+    case k of
+    red: dense := dense + 1;      orange: dense := dense + 2;
+    yellow: dense := dense + 3;   green: dense := dense + 4;
+    cyan: dense := dense + 5;     blue: dense := dense + 6;
+    violet: dense := dense + 7;   black: dense := dense + 8;
+    white: dense := dense + 9;    grey: dense := dense + 10;
+    brown: dense := dense + 11;   pink: dense := dense + 12;
+    gold: dense := dense + 13;    silver: dense := dense + 14;
+    olive: dense := dense + 15;   navy: dense := dense + 16
+    end;
+    n := i mod 1000;
+    case n of
+    0: sparse := sparse + 1;      7: sparse := sparse + 2;
+    50: sparse := sparse + 3;     99: sparse := sparse + 4;
+    128: sparse := sparse + 5;    200: sparse := sparse + 6;
+    333: sparse := sparse + 7;    500: sparse := sparse + 8;
+    640: sparse := sparse + 9;    777: sparse := sparse + 10;
+    900: sparse := sparse + 11;   999: sparse := sparse + 12
+    end;
+    n := i mod 16;
+    case n of
+    0: halves := halves + 1;      2: halves := halves + 2;
+    4: halves := halves + 3;      6: halves := halves + 4;
+    8: halves := halves + 5;      10: halves := halves + 6;
+    12: halves := halves + 7;     14: halves := halves + 8
+    end;
+    c := chr(ord('A') + i mod 26);
+    case c of
+    'A': chars := chars + 1;      'C': chars := chars + 2;
+    'E': chars := chars + 3;      'H': chars := chars + 4;
+    'K': chars := chars + 5;      'M': chars := chars + 6;
+    'P': chars := chars + 7;      'S': chars := chars + 8;
+    'V': chars := chars + 9;      'Z': chars := chars + 10
+    end
+  end;
+  writeln(' dense', dense, ' sparse', sparse, ' halves', halves, ' chars', chars)
+end.
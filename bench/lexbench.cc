@@ -0,0 +1,69 @@
+// The lexer alone: reads each source given and takes its tokens by
+// inSymbol to the end of the text, or of the program where a .data
+// section follows it, a number of rounds over all, and reports the
+// time taken and the tokens per second. The parser and the code
+// generation are not run; see bench/lexbench.sh for the sources of
+// the repository.
+// Usage: bench/lexbench [-rN] file...
+
+#define main pascompl_main
+#include "../pascompl.cc"
+#undef main
+
+// Lexes a source to its end once, adding the time taken to seconds,
+// the setup of the compiler and the reading of the source not timed;
+// returns the tokens taken.
+static int64_t lexSource(char * name, FILE * null, double & seconds)
+{
+    // No object file named: none is to be written or removed
+    char self[] = "lexbench";
+    char * argv[] = { self, name, NULL };
+    std::chrono::steady_clock::time_point start;
+    int status;
+
+    resetState();
+    listing = null;
+    optind = 1;
+    if (not initOptions(2, argv, status))
+        exit(status);
+    initCompiler();
+    readSource();
+    PASINPUT = ugetc();
+    stats = Stats();
+    start = std::chrono::steady_clock::now();
+    try {
+        for (;;)
+            inSymbol();
+    } catch (int foo) {
+        // The end of the text, or a .data section
+    }
+    seconds += secondsSince(start);
+    return stats.tokens;
+}
+
+int main(int argc, char **argv)
+{
+    FILE * null = fopen("/dev/null", "w");
+    int64_t rounds = 10, tokens = 0, bytes = 0;
+    double seconds = 0;
+    int first = 1;
+
+    if (argc > 1 and strncmp(argv[1], "-r", 2) == 0) {
+        rounds = atol(argv[1] + 2);
+        first = 2;
+    }
+    if (first == argc or rounds < 1) {
+        fprintf(stderr, "Usage: %s [-rN] file...\n", argv[0]);
+        return 1;
+    }
+    for (int64_t r = 0; r < rounds; ++r) {
+        for (int i = first; i < argc; ++i) {
+            tokens += lexSource(argv[i], null, seconds);
+            if (r == 0)
+                bytes += srcText.size();
+        }
+    }
+    printf("lexbench: %d files, %ld bytes, %ld tokens in %ld rounds: %.3f sec, %.0f tokens/sec\n",
+           argc - first, bytes, tokens / rounds, rounds, seconds, tokens / seconds);
+    return 0;
+}
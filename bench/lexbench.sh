@@ -0,0 +1,15 @@
+#!/bin/sh
+# Runs bench/lexbench over the Pascal sources of the repository: the
+# programs of tests and bench, and the Pascal text of the dispak jobs,
+# from the card calling the compiler to the next control card.
+# Usage: bench/lexbench.sh [-rN]
+dir=`mktemp -d`
+trap 'rm -rf $dir' 0
+for job in *.b6; do
+    src=$dir/`basename $job .b6`.pas
+    awk '/^\*(trans:|call \*pascom)/ { pascal = 1; next }
+         /^\*[a-z]/ { if (pascal) exit; next }
+         pascal { print }' $job > $src
+    [ -s $src ] || rm $src
+done
+bench/lexbench "$@" tests/*.pas bench/*.pas $dir/*.pas
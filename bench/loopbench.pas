@@ -0,0 +1,52 @@
+program loopbench(output);
+{ The loops keeping addresses and counts in registers: compile with
+  -o- and -o+ in turn, run each under dispak and compare the
+  instructions executed. The sums printed must agree.
+    rows    - a row of a matrix, its index fixed in the inner loop
+    fields  - the fields of a record reached through a pointer, to be
+              compared with the pointer checks off (-s7) as well
+    counts  - a for loop whose body reads its control variable
+    search  - a while loop over an array, the bound kept aside }
+const rounds = 200; size = 40;
+type row = array [1..size] of integer;
+     rec = record key, weight, sum: integer end;
+var m: array [1..size] of row;
+    v: array [1..size] of integer;
+    i, j: integer;
+
+procedure run;
+var r, i, k, n: integer; j: 1..size;
+    rows, counts, search: integer;
+    p: @rec;
+begin
+  new(p);
+  p@.key := 3; p@.weight := 0; p@.sum := 0;
+  rows := 0; counts := 0; search := 0;
+  for r := 1 to rounds do begin
+    for j := 1 to size do
+      for k := 1 to size do
+        rows := rows + m[j][k];
+    for k := 1 to size do begin
+      p@.sum := p@.sum + p@.key;
+      p@.weight := p@.weight + k
+    end;
+    for i := 1 to size do
+      counts := counts + i * 2 - v[i];
+    n := 1;
+    k := r mod size + 1;
+    while v[n] <> k do
+      n := n + 1;
+    search := search + n
+  end;
+  writeln(' rows', rows, ' fields', p@.sum, p@.weight,
+          ' counts', counts, ' search', search)
+end;
+
+begin
+  for i := 1 to size do begin
+    v[i] := i;
+    for j := 1 to size do
+      m[i][j] := i + j
+  end;
+  run
+end.
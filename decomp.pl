@@ -7,6 +7,11 @@ $prog =~ s/\n /;/g;
 
 $/=chr(10);
 
+# dtran -d does the normalization of offsets, for loops and global
+# addresses itself, in one pass; older output still needs it here.
+
+if ($prog !~ /^C Normalized for decomp\.pl/m) {
+
 # Normalizing offsets
 
 $prog =~ s/,;/,0;/g;
@@ -30,6 +35,8 @@ $prog =~ s@;1,UTC,0;(\d+),VTM,(\d+)@;1,UTC,\2;\1,VTM,0@g;
 $prog =~ s@;,UTC,(\d+);1,(...),0@;1,\2,\1@g;
 $prog =~ s@([:;]),UTC,(\d+);2,(...),0@"$1"."2,$3,$2"@ge;
 
+}
+
 # Normalising labels
 
 $prog =~ s/;([^:']+:)/;\1,BSS,;/g;
@@ -0,0 +1,162 @@
+/*
+ * The analysis core of dtran, a disassembler for the BESM-6 executable
+ * binaries produced by Pascal-Autocode.
+ *
+ * A Dtran object owns one memory image and everything found out
+ * about it: which words are code (code_map, cfg), how the data words
+ * are to be shown (format_map), and the labels. The objects do not
+ * share state, so several images may be analysed in one process,
+ * also from different threads.
+ *
+ * Copyright 2019 Leonid Broukhis
+ */
+#ifndef DTRAN_H
+#define DTRAN_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <bitset>
+
+typedef unsigned long long uint64;
+typedef unsigned int uint32;
+typedef unsigned int uint;
+
+struct DtranOptions {
+    uint basereg;               // base register for literals, 0 if none
+    bool nolabels;              // produce a compilable assembly code
+    bool nodlabels;             // no /NNNN labels for data
+    bool nooctal;               // offsets in decimal
+    bool litconst;              // references to constants as literals
+    bool json;                  // line-delimited JSON instead of text
+    bool normalize;             // rewrite the code for decomp.pl
+    int forced_code_off;        // code start, if not to be guessed
+    std::vector<int> entries;   // known entry points
+    // Offsets of known GOST, ITM, ISO and TEXT literals
+    std::set<int> gostoff, itmoff, isooff, textoff;
+    DtranOptions() : basereg(0), nolabels(false), nodlabels(false),
+        nooctal(false), litconst(false), json(false), normalize(false),
+        forced_code_off(0) { }
+};
+
+struct Dtran {
+    enum Format { fLOG, fINT, fGOST, fISO, fTEXT, fITM };
+
+    // Basic blocks of the code reachable from the entry points,
+    // keyed by start address; a block spans [start, end).
+    // Successors include call targets and jump table entries.
+    struct Block {
+        uint end;
+        std::vector<uint> succs;
+    };
+    typedef std::map<uint, Block> cfg_t;
+
+    // Labels are kept as compact records and rendered only
+    // when printed: code labels as Lnnnn, literal constants from
+    // the memory word they refer to, others by their interned name.
+    struct Label {
+        enum Kind { NONE, CODE, LITERAL, NAME, BLANK };
+        unsigned char kind;
+        unsigned short name;    // index in names
+        Label() : kind(NONE), name(0) { }
+        bool empty() const { return kind == NONE; }
+    };
+
+    // One line of the printed text: an instruction, a data word,
+    // or a comment that is not part of the code. Normalization may
+    // delete instructions or insert new ones.
+    struct Line {
+        enum Kind { INSN, DATA, COMMENT, DELETED };
+        Kind kind;
+        uint addr;
+        bool right;             // the right half-word of addr
+        bool labeled;           // carries the code label of addr
+        bool inserted;          // added by normalization
+        uint reg;
+        std::string op;         // opcode, or the data format
+        std::string operand;    // operand, data value or comment text
+        int target;             // the labeled address referred to, or -1
+        Line() : kind(INSN), addr(0), right(false), labeled(false),
+            inserted(false), reg(0), target(-1) { }
+    };
+
+    Dtran(const DtranOptions & o);
+
+    // Read the image from a file, or take it from memory (the words
+    // to be placed from address 02000 on), and analyse it.
+    // On failure, the reason is reported to stderr.
+    bool load(const char * fname);
+    bool load(const uint64 * words, uint len);
+
+    // Print the analysed image in the DTRAN assembly format or, with
+    // the json option, as one JSON object per line: the header, then an
+    // object per instruction (addr, half, label, reg, op, operand, and
+    // for references to labeled words target and literal), per data word
+    // (addr, label, data format, value, word) and per routine symbol table.
+    // With the normalize option, the for loops and the references to
+    // global addresses are first rewritten to the forms decomp.pl expects,
+    // and empty operands are printed as 0; the inserted instructions
+    // are marked as new in JSON.
+    void print(FILE * f);
+
+    uint head_len;
+    uint code_len;              // end of the user code
+    uint mem_size;              // as given in the image header
+    uint total_len;             // without the trailing zero words
+    uint main_off;
+    uint code_off;
+    uint basereg, baseop, baseaddr;
+    bool nolabels, nooctal, nodlabels, litconst, json, normalize;
+    int forced_code_off;
+    std::vector<int> entries;
+    std::set<int> gostoff, itmoff, isooff, textoff;
+
+    std::vector<uint64> memory;
+    cfg_t cfg;
+    std::bitset<32768> code_map;
+    std::vector<Format> format_map;
+    std::vector<std::string> symtab;
+    std::vector<Label> labels;      // indexed by address
+    std::vector<std::string> names; // of the NAME labels
+    std::vector<Line> listing;      // the code part, as last printed
+
+    // The text of the label at addr, empty if there is none.
+    std::string label_str(uint addr);
+
+private:
+    FILE * out;
+    bool prev_addrmod;
+
+    bool analyze(uint codelen, uint addr);
+    void fill_lengths();
+    void mklabel(uint off);
+    uint check_chain(uint prev);
+    bool scan_word(uint cur, std::vector<uint> & succs);
+    void split_block(uint addr);
+    uint find_code_offset();
+    void mklabels(uint32 memaddr, uint32 opcode, bool litconst);
+    void label_patterns();
+    uint label_pattern(void * pattern, size_t size, std::string name);
+    void name_label(uint addr, const std::string & name);
+    std::string label_operand(uint addr);
+    void populate_formats();
+    std::string get_literal(uint32 addr);
+
+    void prheader();
+    void prinsn(uint32 memaddr, uint32 opcode, bool right);
+    void comment_line(const std::string & text);
+    void prline(const Line & l);
+    size_t next_insn(size_t i);
+    bool apply_rules(size_t i);
+    void normalize_loops();
+    void normalize_listing();
+    void pr1const(uint cur, bool litconst);
+    void prconst(bool litconst);
+    void prtext(bool litconst);
+    void prsyms(uint cur, uint start);
+    void prsymtab();
+};
+
+#endif
@@ -0,0 +1,1456 @@
+/*
+ * The analysis core of dtran: loading of a BESM-6 memory image,
+ * finding the code, the data formats and the labels, and printing
+ * the result as DTRAN assembly code.
+ *
+ * Copyright 2019 Leonid Broukhis
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cstdarg>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <sys/stat.h>
+#include <stdint.h>
+#include "dtran.h"
+
+/*
+ * BESM-6 opcode types.
+ */
+typedef enum {
+OPCODE_ILLEGAL,
+OPCODE_STR1,		/* short addr */
+OPCODE_STR2,		/* long addr */
+OPCODE_IMM,		/* e.g. NTR */
+OPCODE_REG1,		/* e.g. ATI */
+OPCODE_JUMP,		/* UJ */
+OPCODE_BRANCH,		/* UZA, U1A, VZM, V1M, VLM */
+OPCODE_CALL,		/* VJM */
+OPCODE_IMM64,		/* e.g. ASN */
+OPCODE_ADDRMOD,		/* UTC, WTC */
+OPCODE_REG2,		/* VTM, UTM */
+OPCODE_IMMEX,		/* *50, ... */
+OPCODE_ADDREX,		/* *64, *70, ... */
+OPCODE_STOP,		/* *74 */
+OPCODE_DEFAULT
+} opcode_e;
+
+static const struct opcode {
+	const char *name;
+	uint opcode;
+	uint mask;
+	opcode_e type;
+} op[] = {
+  /* name,	pattern,  mask,	    opcode type */
+  { "ATX",	0x000000, 0x0bf000, OPCODE_STR1 },
+  { "STX",	0x001000, 0x0bf000, OPCODE_STR1 },
+  { "XTS",	0x003000, 0x0bf000, OPCODE_STR1 },
+  { "A+X",	0x004000, 0x0bf000, OPCODE_STR1 },
+  { "A-X",	0x005000, 0x0bf000, OPCODE_STR1 },
+  { "X-A",	0x006000, 0x0bf000, OPCODE_STR1 },
+  { "AMX",	0x007000, 0x0bf000, OPCODE_STR1 },
+  { "XTA",	0x008000, 0x0bf000, OPCODE_STR1 },
+  { "AAX",	0x009000, 0x0bf000, OPCODE_STR1 },
+  { "AEX",	0x00a000, 0x0bf000, OPCODE_STR1 },
+  { "ARX",	0x00b000, 0x0bf000, OPCODE_STR1 },
+  { "AVX",	0x00c000, 0x0bf000, OPCODE_STR1 },
+  { "AOX",	0x00d000, 0x0bf000, OPCODE_STR1 },
+  { "A/X",	0x00e000, 0x0bf000, OPCODE_STR1 },
+  { "A*X",	0x00f000, 0x0bf000, OPCODE_STR1 },
+  { "APX",	0x010000, 0x0bf000, OPCODE_STR1 },
+  { "AUX",	0x011000, 0x0bf000, OPCODE_STR1 },
+  { "ACX",	0x012000, 0x0bf000, OPCODE_STR1 },
+  { "ANX",	0x013000, 0x0bf000, OPCODE_STR1 },
+  { "E+X",	0x014000, 0x0bf000, OPCODE_STR1 },
+  { "E-X",	0x015000, 0x0bf000, OPCODE_STR1 },
+  { "ASX",	0x016000, 0x0bf000, OPCODE_STR1 },
+  { "XTR",	0x017000, 0x0bf000, OPCODE_STR1 },
+  { "RTE",	0x018000, 0x0bf000, OPCODE_IMM },
+  { "YTA",	0x019000, 0x0bf000, OPCODE_IMM64 },
+  { "E+N",	0x01c000, 0x0bf000, OPCODE_IMM64 },
+  { "E-N",	0x01d000, 0x0bf000, OPCODE_IMM64 },
+  { "ASN",	0x01e000, 0x0bf000, OPCODE_IMM64 },
+  { "NTR",	0x01f000, 0x0bf000, OPCODE_IMM },
+  { "ATI",	0x020000, 0x0bf000, OPCODE_REG1 },
+  { "STI",	0x021000, 0x0bf000, OPCODE_REG1 },
+  { "ITA",	0x022000, 0x0bf000, OPCODE_REG1 },
+  { "ITS",	0x023000, 0x0bf000, OPCODE_REG1 },
+  { "MTJ",	0x024000, 0x0bf000, OPCODE_REG1 },
+  { "M+J",	0x025000, 0x0bf000, OPCODE_REG1 },
+  { "*50",	0x028000, 0x0bf000, OPCODE_IMMEX },
+  { "*51",	0x029000, 0x0bf000, OPCODE_IMMEX },
+  { "*52",	0x02a000, 0x0bf000, OPCODE_IMMEX },
+  { "*53",	0x02b000, 0x0bf000, OPCODE_IMMEX },
+  { "*54",	0x02c000, 0x0bf000, OPCODE_IMMEX },
+  { "*55",	0x02d000, 0x0bf000, OPCODE_IMMEX },
+  { "*56",	0x02e000, 0x0bf000, OPCODE_IMMEX },
+  { "*57",	0x02f000, 0x0bf000, OPCODE_IMMEX },
+  { "*60",	0x030000, 0x0bf000, OPCODE_ADDREX },
+  { "*61",	0x031000, 0x0bf000, OPCODE_ADDREX },
+  { "*62",	0x032000, 0x0bf000, OPCODE_IMMEX },
+  { "*63",	0x033000, 0x0bf000, OPCODE_IMMEX },
+  { "*64",	0x034000, 0x0bf000, OPCODE_ADDREX },
+  { "*65",	0x035000, 0x0bf000, OPCODE_IMMEX },
+  { "*66",	0x036000, 0x0bf000, OPCODE_IMMEX },
+  { "*67",	0x037000, 0x0bf000, OPCODE_ADDREX },
+  { "*70",	0x038000, 0x0bf000, OPCODE_ADDREX },
+  { "*71",	0x039000, 0x0bf000, OPCODE_ADDREX },
+  { "*72",	0x03a000, 0x0bf000, OPCODE_ADDREX },
+  { "*73",	0x03b000, 0x0bf000, OPCODE_ADDREX },
+  { "*74",	0x03c000, 0x0bf000, OPCODE_STOP },
+  { "CTX",	0x03d000, 0x0bf000, OPCODE_ADDREX },
+  { "*76",	0x03e000, 0x0bf000, OPCODE_IMMEX },
+  { "*77",	0x03f000, 0x0bf000, OPCODE_IMMEX },
+  { "UTC",	0x090000, 0x0f8000, OPCODE_ADDRMOD },
+  { "WTC",	0x098000, 0x0f8000, OPCODE_ADDRMOD },
+  { "VTM",	0x0a0000, 0x0f8000, OPCODE_REG2 },
+  { "UTM",	0x0a8000, 0x0f8000, OPCODE_REG2 },
+  { "UZA",	0x0b0000, 0x0f8000, OPCODE_BRANCH },
+  { "U1A",	0x0b8000, 0x0f8000, OPCODE_BRANCH },
+  { "UJ",	0x0c0000, 0x0f8000, OPCODE_JUMP },
+  { "VJM",	0x0c8000, 0x0f8000, OPCODE_CALL },
+  { "VZM",	0x0e0000, 0x0f8000, OPCODE_BRANCH },
+  { "V1M",	0x0e8000, 0x0f8000, OPCODE_BRANCH },
+  { "VLM",	0x0f8000, 0x0f8000, OPCODE_BRANCH },
+/* This entry MUST be last; it is a "catch-all" entry that will match when no
+ * other opcode entry matches during disassembly.
+ */
+  { "",		0x0000, 0x0000, OPCODE_ILLEGAL },
+};
+
+static std::string strprintf(const char * fmt, ...) {
+    std::string ret;
+    char * str;
+    va_list ap;
+    va_start (ap, fmt);
+    vasprintf(&str, fmt, ap);
+    va_end(ap);
+    ret = str;
+    free(str);
+    return ret;
+}
+
+static const char * gost_to_utf[] = {
+    "0", "1", "2", "3", "4", "5", "6", "7",
+    "8", "9", "+", "-", "/", ",", ".", " ",
+    "⏨", "↑", "(", ")", "×", "=", "smc", "[", // s = semicolon
+    "]", "*", "`", "'", "#", "<", ">", ":",
+    "А", "Б", "В", "Г", "Д", "Е", "Ж", "З",
+    "И", "Й", "К", "Л", "М", "Н", "О", "П",
+    "Р", "С", "Т", "У", "Ф", "Х", "Ц", "Ч",
+    "Ш", "Щ", "Ы", "Ь", "Э", "Ю", "Я", "D",
+    "F", "G", "I", "J", "L", "N", "Q", "R",
+    "S", "U", "V", "W", "Z", "^", "≤", "≥",
+    "∨", "&", "⊃", "~", "÷", "≡", "%", "$",
+    "|", "—", "_", "!", "\"", "Ъ", "?", "′"
+};
+
+static const unsigned char gost_to_itm [0140] =
+{
+/* 000-007 */   0000,   0001,   0002,   0003,   0004,   0005,   0006,   0007,
+/* 010-017 */   0010,   0011,   0061,   0070,   0067,   0046,   0047,   0017,
+/* 020-027 */   0176,   0143,   0076,   0051,   0072,   0057,   0045,   0053,
+/* 030-037 */   0066,   0170,   0064,   0041,   0152,   0074,   0054,   0056,
+/* 040-047 */   0230,   0323,   0223,   0313,   0322,   0220,   0317,   0321,
+/* 050-057 */   0314,   0332,   0236,   0311,   0207,   0205,   0203,   0315,
+/* 060-067 */   0215,   0216,   0201,   0225,   0326,   0227,   0316,   0331,
+/* 070-077 */   0324,   0301,   0325,   0327,   0320,   0334,   0335,   0222,
+/* 100-107 */   0226,   0213,   0214,   0232,   0211,   0206,   0235,   0212,
+/* 110-117 */   0224,   0234,   0217,   0231,   0221,   0050,   0074,   0054,
+/* 120-127 */   0060,   0071,   0055,   0145,   0065,   0075,   0062,   0042,
+/* 130-137 */   0044,   0150,   0043,   0063,   0134,   0136,   0   ,   0   ,
+};
+
+// The ITM to UTF-8 table is built on first use, which is thread-safe.
+struct ItmTable {
+    const char * utf[256];
+    ItmTable() {
+        std::fill(utf, utf+256, (const char*)0);
+        utf[0] = gost_to_utf[0];
+        for (int i = 1; i < 0140; ++i) {
+            if (gost_to_itm[i] == 0)
+                continue;
+            if (utf[gost_to_itm[i]])
+                fprintf(stderr, "GOST %03o maps to the same ITM as GOST %s\n",
+                        i, utf[gost_to_itm[i]]);
+            else
+                utf[gost_to_itm[i]] = gost_to_utf[i];
+        }
+    }
+};
+
+static const char * const * itm_to_utf() {
+    static const ItmTable table;
+    return table.utf;
+}
+
+// A JSON string literal; the text is UTF-8 already.
+static std::string json_str(const std::string & s) {
+    std::string ret = "\"";
+    for (size_t i = 0; i < s.size(); ++i) {
+        unsigned char c = s[i];
+        if (c == '"' || c == '\\') {
+            ret += '\\';
+            ret += c;
+        } else if (c < 040)
+            ret += strprintf("\\u%04x", c);
+        else
+            ret += c;
+    }
+    return ret + '"';
+}
+
+static std::string get_gost_char (unsigned char ch) {
+    if (ch < 0140)
+        return gost_to_utf[ch];
+    else
+        return strprintf("_%03o", ch);
+}
+static std::string get_itm_char (unsigned char ch) {
+    return itm_to_utf()[ch] ? itm_to_utf()[ch] : "#@#";
+}
+
+#if 1
+static std::string get_iso_char (unsigned char ch) {
+	ch &= 0177;
+    if (ch >= 040 && ch < 0140) { std::string ret; return ret=ch; }
+	if (ch < 040 || ch >= 0177) return strprintf("_%03o", ch);
+    return std::string(&"ЮАБЦДЕФГХИЙКЛМНОПЯРСТУЖВЬЫЗШЭЩЧ\177"[2*(ch-0140)], 2);
+}
+
+static std::string get_iso_word(uint64 word) {
+    std::string ret;
+	if (word < 256) return get_iso_char(word);
+    for (uint i = 40; i <= 40; i-=8) {
+        ret += get_iso_char(word >> i);
+    }
+    return ret;
+}
+#endif
+static std::string get_text_char (unsigned char ch) {
+    static const char * text_to_utf[] = {
+        " ", ".", "Б", "Ц", "Д", "Ф", "Г", "И",
+        "(", ")", "*", "Й", "Л", "Я", "Ж", "/",
+        "0", "1", "2", "3", "4", "5", "6", "7",
+        "8", "9", "Ь", ",", "П", "-", "+", "Ы",
+        "З", "A", "B", "C", "D", "E", "F", "G",
+        "H", "I", "J", "K", "L", "M", "N", "O",
+        "P", "Q", "R", "S", "T", "U", "V", "W",
+        "X", "Y", "Z", "Ш", "Э", "Щ", "Ч", "Ю"
+    };
+    return text_to_utf[ch & 63];
+}
+
+static std::string get_text_word(uint64 word) {
+    std::string ret;
+    for (uint i = 42; i <= 42; i-=6) {
+        ret += get_text_char(word >> i);
+    }
+    return ret;
+}
+
+static std::string get_gost_word(uint64 word) {
+    std::string ret;
+    for (uint i = 40; i <= 40; i-=8) {
+        ret += get_gost_char(word >> i);
+    }
+    return ret;
+}
+static std::string get_itm_word(uint64 word) {
+    std::string ret;
+    for (uint i = 40; i <= 40; i-=8) {
+        ret += get_itm_char(word >> i);
+    }
+    return ret;
+}
+static std::string get_bytes(uint64 word) {
+    std::string ret;
+    for (uint i = 40; i <= 40; i-=8) {
+        ret += strprintf("%03o ", int(word >> i) & 0377);
+    }
+    return ret;
+}
+
+#if 1
+static bool is_likely_iso (uint64 word) {
+	int zeromask = 0;
+    for (uint i = 0; i < 48; i += 8) {
+        uint val = (word >> i) & 0377;
+        if (val != 0 && (val < 040 || val >= 0177))
+            return false;
+	    if (val == 0) zeromask |= 1 << (i/8);
+    }
+    return zeromask != 63 &&
+	 (zeromask == 0 || ((zeromask+1) & zeromask) == 0 || zeromask == 62);
+}
+static bool is_valid_iso (uint64 word) {
+	return is_likely_iso(word);
+}
+#endif
+
+static bool is_likely_text(uint64 word) {
+    // Of all groups of 6 bits, they should be left-
+    // or right-aligned, there must be no spaces in the middle,
+    // and no unused codes or Cyrillics.
+    int seen0 = 0, seen_char = 0;
+    bool last0 = false;
+    for (uint i = 42; i <= 42; i-=6) {
+        uint val = (word >> i) & 077;
+        switch (val) {
+        case 001 ... 011:
+        case 013 ... 016:
+        case 032 ... 034:
+        case 037:
+        case 040:
+        case 073 ... 077:
+            return false;
+        case 0:
+            if (seen_char && seen0 && !last0) return false;
+            ++seen0;
+            last0 = true;
+            break;
+        default:
+            if (seen_char && seen0 && last0) return false;
+            ++seen_char;
+            last0 = false;
+        }
+    }
+    return seen_char > 1;
+}
+
+
+// Kept for the disabled text detection in populate_formats().
+[[maybe_unused]] static bool is_valid_gost (uint64 word) {
+    for (uint i = 0; i < 48; i += 8) {
+        uint val = (word >> i) & 0377;
+        switch (val) {
+            case 0377: case 0143: case 0162: case 0172:
+		case 0146:
+            case 0175: case 0214:
+                break;
+		case 020: case 021: case 024: case 034: /* unlikely chars */
+			return false;	
+            default:
+                if (val >= 0116)
+			return false;
+            }
+    }
+    return true;
+}
+static bool is_likely_gost (uint64 word) {
+	int total = 0, zeros = 0;
+    for (uint i = 0; i < 48; i += 8) {
+        uint val = (word >> i) & 0377;
+	    // trailing zeros not counted
+        if (total && val == 0) ++zeros,++total;
+	    if (val) ++total;
+        switch (val) {
+            case 0377: case 0143: case 0162: case 0172:
+		case 0146:
+            case 0175: case 0214:
+                break;
+        case 020: case 021: case 024: case 034: /* unlikely chars */
+			return false;	
+            default:
+                if (val >= 0116)
+			return false;
+            }
+    }
+    return (word >> 40) || (word >> 32) && total-zeros > 2;
+}
+[[maybe_unused]] static bool is_valid_itm(uint64 word) {
+    for (uint i = 0; i < 48; i += 8) {
+        uint val = (word >> i) & 0377;
+        if (!itm_to_utf()[val])
+            return false;
+    }
+    return true;
+}
+
+
+static bool is_likely_itm(uint64 word) {
+	int total = 0, zeros = 0;
+    for (uint i = 0; i < 48; i += 8) {
+        uint val = (word >> i) & 0377;
+	    // trailing zeros not counted
+        if (total && val == 0) ++zeros,++total;
+	    if (val) ++total;
+        if (!itm_to_utf()[val])
+            return false;
+    }
+    return (word >> 40) || (word >> 32) && total-zeros > 2;
+}
+
+void Dtran::fill_lengths() {
+        head_len = 0;           // the binary is read to address 0
+        total_len = ((memory[02011] && memory[02011] < 037) ? 
+		memory[02011] : memory[02010]) * 02000 + 02000;
+//        labels.resize(total_len);
+        mem_size = total_len;
+        main_off = 02000; // memory[02011] & 077777;
+        mklabel(main_off);
+        code_map.reset();
+        code_off = std::max(main_off, find_code_offset());
+}
+
+void Dtran::prheader() {
+        if (json) {
+            fprintf(out, "{\"name\":%s,\"mem_size\":%u,\"code_start\":%u,"
+                    "\"main\":%u,\"date\":%s}\n",
+                    json_str(get_gost_word(memory[1])).c_str(), mem_size,
+                    code_off, main_off, json_str(get_gost_word(memory[2])).c_str());
+            return;
+        }
+        fprintf(out, " %s:,NAME, NEW DTRAN\n",
+               get_gost_word(memory[1]).c_str());
+        fprintf(out, "C Memory size: %o\n", mem_size);
+        fprintf(out, "C Code start: %o\n", code_off);
+        fprintf(out, "C Program start: %o\n", main_off);
+	fprintf(out, "C Compilation date: %s\n", get_gost_word(memory[2]).c_str());
+        fprintf(out, "C Aligning line numbers\nC to addresses\nC of literal constants\n");
+        if (normalize)
+            fprintf(out, "C Normalized for decomp.pl\n");
+        if (nolabels) {
+            fprintf(out, " /:,BSS,\n");
+        }
+}
+
+/*
+ * Read a 48-bit word at the current file position.
+ */
+static uint64
+freadw (FILE *fd)
+{
+    uint64 val = 0;
+    int i;
+    for (i = 0; i < 6; ++i) {
+        val <<= 8;
+        val |= getc (fd);
+    }
+    return val;
+}
+
+void Dtran::mklabel(uint off) {
+    labels[off].kind = Label::CODE;
+}
+
+uint Dtran::check_chain(uint prev) {
+    uint prevop = (prev & 03700000) >> 15;
+    if (prevop == 024 && (prev >> 20) == 13) {
+        uint next_addr = prev & 077777;
+        if (next_addr && next_addr < total_len) {
+            mklabel(next_addr);
+            return next_addr;
+        }
+    }
+    return 0;
+}
+
+// Decodes one word of code at cur, appending the addresses control
+// may pass to (other than cur+1) to succs. Returns true if execution
+// can fall through to the next word.
+bool Dtran::scan_word(uint cur, std::vector<uint> & succs) {
+    uint64 word = memory[cur];
+    uint insn[2];
+    insn[0] = word >> 24;
+    insn[1] = word & 0xFFFFFF;
+    for (uint i = 0; i < 2; ++i) {
+        uint cinsn = insn[i];
+        uint next_addr;
+        uint opcode = (cinsn & 03700000) >> 15;
+        if (opcode == 031 || opcode == 034 || opcode == 035) { // VJM, VZM, V1M, any reg
+            next_addr = cinsn & 077777;
+            if (next_addr && next_addr < total_len) {
+                mklabel(next_addr);
+                succs.push_back(next_addr);
+            }
+            // (value _IN type) is 13,VTM,iffalse; 14,VJM,test
+            if (opcode == 031 && (cinsn >> 20) == 14) {
+                uint prev = i == 1 ? insn[0] : memory[cur-1] & 0xFFFFFF;
+                if (uint next = check_chain(prev))
+                    succs.push_back(next);
+            }
+            return true;
+        } else if (opcode == 030) { // UJ
+            next_addr = cinsn & 077777;
+            uint idx = cinsn >> 20;
+            if (next_addr && next_addr < total_len && idx == 0) {
+                succs.push_back(next_addr);
+                mklabel(next_addr);
+                uint prev = i == 1 ? insn[0] : memory[cur-1] & 0xFFFFFF;
+                if (uint next = check_chain(prev))
+                    succs.push_back(next);
+            } else if ((next_addr == cur || next_addr == cur+1) && (cinsn >> 20) != 0) {
+                // This looks like a jump table.
+                for(uint t = next_addr; t < total_len; ++t) {
+                    uint64_t entry = memory[t];
+                    uint entop = (entry >> (24+15)) & 037;
+                    uint entidx = entry >> (24+20);
+                    if (entop == 030 && entidx == 0) { // A jump
+                        succs.push_back(t);
+                    } else
+                        break;
+                }
+            }
+            return false;
+        } else if ((cinsn & 077600000) == 002600000 // U1A, UZA, 0 reg
+                   || ((cinsn & 077700000) == 042600000)) { // 8,UZA - case stmt by branching with 8 as base
+            next_addr = cinsn & 077777;
+            if (next_addr && next_addr < total_len) {
+                succs.push_back(next_addr);
+                mklabel(next_addr);
+            }
+        }
+    }
+    return true;
+}
+
+// Makes addr, which must already be covered by a block, the start of one.
+void Dtran::split_block(uint addr) {
+    cfg_t::iterator it = cfg.upper_bound(addr);
+    --it;
+    if (it->first == addr)
+        return;
+    Block & tail = cfg[addr];
+    tail.end = it->second.end;
+    tail.succs.swap(it->second.succs);
+    it->second.end = addr;
+    it->second.succs.assign(1, addr);
+}
+
+uint Dtran::find_code_offset() {
+    std::vector<uint> todo;
+    todo.push_back(main_off);
+    if (!entries.empty()) {
+        for (uint i = 0; i < entries.size(); ++i) {
+            todo.push_back(entries[i]);
+            mklabel(entries[i]);
+        }
+        fprintf(stderr, "Got %lu known entry points\n", todo.size());
+    }
+    
+    // Looking for all opcodes '16 31 XXXXX' and finding the lowest
+    // by transitive closure, ignoring '16 31 00000' as an indirect call.
+    // Each block is decoded straight through to its end; jumping into
+    // the middle of a known block splits it.
+    while (!todo.empty()) {
+        uint cur = todo.back();
+        todo.pop_back();
+        if (cur >= total_len) continue;
+        if (code_map[cur]) {
+            split_block(cur);
+            continue;
+        }
+        Block & blk = cfg[cur];
+        bool falls;
+        do {
+            code_map[cur] = true;
+            falls = scan_word(cur, blk.succs);
+            ++cur;
+        } while (falls && cur < total_len && !code_map[cur]);
+        blk.end = cur;
+        if (falls && cur < total_len) {
+            blk.succs.push_back(cur);
+            if (code_map[cur])
+                split_block(cur);
+        }
+        todo.insert(todo.end(), blk.succs.begin(), blk.succs.end());
+    }
+    uint min_addr = cfg.empty() ? total_len : cfg.begin()->first;
+    return forced_code_off ? forced_code_off : min_addr;
+}
+    
+void
+Dtran::mklabels(uint32 memaddr, uint32 opcode, bool litconst) {
+    int arg1 = (opcode & 07777) + (opcode & 0x040000 ? 070000 : 0);
+    int arg2 = opcode & 077777;
+    int struc = opcode & 02000000;
+    uint reg = opcode >> 20;
+    uint op = struc ? (opcode >> 15) & 037 : (opcode >> 12) & 077;
+    if (basereg && basereg == reg) {
+        if (baseaddr == ~0u &&
+            (opcode & 03700000) == 02400000) {
+            baseaddr = opcode & 037777;
+            baseop = opcode;
+            fprintf(stderr, "@%05o Base register set to %05o\n", memaddr, baseaddr);
+        } else if (struc) {
+            // Must be the same opcode as used originally.
+            if (memaddr < code_len && (baseaddr == ~0u || baseop != opcode)) {
+                fprintf(stderr,
+                        "@%05o Base register used in a long-address insn\n", memaddr);
+//                exit(1);
+            }
+        } else if (baseaddr == ~0u) {
+            fprintf(stderr,
+                    "@%05o Base register used but not yet set\n", memaddr);
+//            exit(1);
+        } else if (memaddr < code_len && arg1 >= 010000) {
+            fprintf(stderr,
+                    "@%05o Base register used with a negative value (%04o)\n", memaddr, arg1);
+//            exit(1);
+        } else {
+            uint off = (baseaddr + arg1) % 32768;
+            if (off >= labels.size()) {
+                fprintf(stderr, "@%05o Base offset %05o too large\n", memaddr, arg1);
+//                exit(1);
+            }
+            if (labels[off].empty())
+                labels[off].kind = litconst ? Label::LITERAL : Label::CODE;
+        }
+    } else if (!struc && !reg && arg1 >= 011 && arg1 < total_len && labels[arg1].empty()) {
+        labels[arg1].kind = litconst ? Label::LITERAL : Label::CODE;
+    } else if (struc && arg2 >= 011 && arg2 < total_len &&
+               (op == 030 || op == 037 || op == 024) && reg != 10) {
+        if (labels[arg2].empty() && (code_map[arg2] || reg == 11)) {
+            // fprintf(stderr, "Labeling %05o due to %05o: %02o %02o %05o\n",
+            // arg2, memaddr, reg, op, arg2);
+            if (litconst && op == 024 && reg == 11)
+                /* labels[arg2] = get_literal(arg2) */;
+            else
+                mklabel(arg2);
+        }
+    }
+}
+
+static int get_opidx(uint32 opcode) {
+    int i = -1;
+    do {
+	i = i + 1;
+        if ((opcode & op[i].mask) == op[i].opcode)
+            return i;
+    } while (op[i].mask);
+    return -1;
+}
+  
+void
+Dtran::prinsn (uint32 memaddr, uint32 opcode, bool right)
+{
+    Line line;
+    int i;
+
+    uint reg = opcode >> 20;
+    int arg1 = (opcode & 07777) + (opcode & 0x040000 ? 070000 : 0);
+    int arg2 = opcode & 077777;
+    int struc = opcode & 02000000;
+    int arg = struc ? arg2 : arg1;
+
+    i = get_opidx(opcode);
+
+    opcode_e type = op[i].type;
+    std::string opname = op[i].name;
+    if (type == OPCODE_ILLEGAL) {
+        opname = struc ? strprintf("%2o", (opcode >> 15) & 037)
+            : strprintf("%03o", (opcode >> 12) & 0177);
+    } else if (!struc && basereg && reg == basereg) {
+        reg = 0;
+        if (baseaddr != ~0u) arg1 += baseaddr;
+    }
+    std::string operand;
+    int target = -1;            // the labeled address referred to
+    if (arg)
+        operand = strprintf(struc ? "U%05o" : "U%04o", struc ? arg2 : arg1);
+    if (struc && arg2 && arg2 < labels.size()) {
+        uint off = arg2;
+        bool good = code_off <= off && off <= total_len;
+        if (!good || labels[off].empty() || ((opcode >> 15) & 037) == 025 || (reg != 0 && type == OPCODE_ADDRMOD))
+            operand = strprintf("%d", off);
+        else {
+            operand = label_operand(off);
+            target = off;
+        }
+    } else if (uint val = struc ? arg2 : arg1) {
+        if (type == OPCODE_REG1 || val < 8 || prev_addrmod)
+            operand = strprintf("%d", val);
+        else if (type == OPCODE_IMM64) {
+            operand = strprintf("64%+d", val-64);
+        } else if (!struc && !reg && type != OPCODE_IMMEX &&
+                   arg1 >= code_off && arg1 < code_len) {
+            operand = label_operand(arg1);
+            target = arg1;
+        } else
+            operand = strprintf(type != OPCODE_IMMEX && nooctal ?
+                                "%d" : "%oB", val);
+    }
+
+    if (basereg && reg == basereg) {
+        if (op[i].opcode == 02400000) {
+            opname = "BASE";
+        } else {
+            reg = 0;
+            target = (baseaddr + arg1) % 32768;
+            operand = label_operand(target);
+        }
+    }
+
+    prev_addrmod = type == OPCODE_ADDRMOD;
+    line.kind = Line::INSN;
+    line.addr = memaddr;
+    line.right = right;
+    line.labeled = !right && labels[memaddr].kind == Label::CODE;
+    line.reg = reg;
+    line.op = opname;
+    line.operand = operand;
+    line.target = target;
+    listing.push_back(line);
+}
+
+void Dtran::prline(const Line & l) {
+    if (l.kind == Line::DELETED)
+        return;
+    if (json) {
+        if (l.kind == Line::COMMENT)
+            return;
+        fprintf(out, "{\"addr\":%u", l.addr);
+        if (l.kind == Line::INSN)
+            fprintf(out, ",\"half\":%d", l.right);
+        if (l.labeled)
+            fprintf(out, ",\"label\":\"L%04o\"", l.addr);
+        if (l.inserted)
+            fprintf(out, ",\"new\":true");
+        if (l.kind == Line::DATA) {
+            fprintf(out, ",\"data\":\"%s\",\"value\":%s,\"word\":%llu}\n",
+                    l.op.c_str(), json_str(l.operand).c_str(), memory[l.addr]);
+            return;
+        }
+        fprintf(out, ",\"reg\":%u,\"op\":%s,\"operand\":%s", l.reg,
+                json_str(l.op).c_str(), json_str(l.operand).c_str());
+        if (l.target >= 0) {
+            fprintf(out, ",\"target\":%d", l.target);
+            if (labels[l.target].kind == Label::LITERAL)
+                fprintf(out, ",\"literal\":%s,\"word\":%llu",
+                        json_str(l.operand).c_str(), memory[l.target]);
+        }
+        fprintf(out, "}\n");
+        return;
+    }
+    switch (l.kind) {
+    case Line::COMMENT:
+        fprintf(out, "%s\n", l.operand.c_str());
+        return;
+    case Line::DATA:
+        if (!nodlabels) {
+            fprintf(out, " /%d:", l.addr);
+        } else if (!l.labeled) {
+            fprintf(out, " ");
+        } else {
+            fprintf(out, " L%04o:", l.addr);
+        }
+        fprintf(out, ",%s,%s\n", l.op.c_str(), l.operand.c_str());
+        return;
+    case Line::DELETED:
+        return;
+    case Line::INSN:
+        if (!l.labeled) {
+            putc(' ', out);
+        } else if (nolabels) {
+            fprintf(out, " :");
+        } else {
+            fprintf(out, " L%04o:", l.addr);
+        }
+        if (l.reg) fprintf(out, "%d,", l.reg); else fprintf(out, ",");
+        fprintf(out, "%s,%s\n", l.op.c_str(), l.operand.c_str());
+    }
+}
+
+void Dtran::name_label(uint addr, const std::string & name) {
+    uint idx = std::find(names.begin(), names.end(), name) - names.begin();
+    if (idx == names.size())
+        names.push_back(name);
+    labels[addr].kind = Label::NAME;
+    labels[addr].name = idx;
+}
+
+std::string Dtran::label_str(uint addr) {
+    switch (labels[addr].kind) {
+    case Label::CODE: return strprintf("L%04o", addr);
+    case Label::LITERAL: return get_literal(addr);
+    case Label::NAME: return names[labels[addr].name];
+    case Label::BLANK: return " ";
+    }
+    return std::string();
+}
+
+// As label_str(), but code labels are relative to / if they
+// are not to be printed.
+std::string Dtran::label_operand(uint addr) {
+    if (nolabels && labels[addr].kind == Label::CODE)
+        return strprintf(nooctal ? "/+%d" : "/+%oB", addr);
+    return label_str(addr);
+}
+
+std::string Dtran::get_literal(uint32 addr) {
+    uint64 val = memory[addr];
+    std::string ret;
+    uint64 d = val & 0x7FFFFFFFFFFFull;
+    if ((val >> 38) == 01000 && d != 0) {
+        if (d > 10000)
+            ret = strprintf("DIV%d", (1ull << 40)/(d-1));
+        else
+            ret = strprintf("mul(%d)", d);
+    } else if (format_map[addr] == fGOST) {
+        ret = strprintf("'%s'", get_gost_word(val).c_str());
+    } else if (format_map[addr] == fISO) {
+        ret = strprintf("'%s'", get_iso_word(val).c_str());
+    } else if (format_map[addr] == fITM) {
+        ret = strprintf("itm'%s'", get_itm_word(val).c_str());
+    } else if (format_map[addr] == fTEXT) {
+        ret = strprintf("\"%s\"", get_text_word(val).c_str());
+    } else if (format_map[addr] == fINT) {
+        int d = val;
+        ret = strprintf("(%d)", d);
+    } else if (textoff.count(addr)) {
+        ret = strprintf("|%s|", get_text_word(val).c_str());
+    } else {
+        ret = strprintf("(%lloC)", val);
+    }
+    return ret;
+}
+
+void Dtran::pr1const(uint cur, bool litconst) {
+    uint64 val = memory[cur];
+    std::string fmt, value;
+    Format f = format_map[cur];
+    if (gostoff.count(cur))
+        f = fGOST;
+    else if (itmoff.count(cur))
+        f = fITM;
+    else if (isooff.count(cur))
+        f = fISO;
+    else if (textoff.count(cur))
+        f = fTEXT;
+    switch (f) {
+    case fINT: fmt = "INT"; value = strprintf("%d . 0%o", (int)val, (int)val); break;
+    case fGOST: fmt = "GOST"; value = strprintf(" |%s| %s", get_gost_word(val).c_str(), get_bytes(val).c_str()); break;
+    case fISO: fmt = "ISO"; value = strprintf(" |%s| %s", get_iso_word(val).c_str(), get_bytes(val).c_str()); break;
+    case fTEXT: fmt = "TEXT"; value = strprintf(" |%s| %s", get_text_word(val).c_str(), get_bytes(val).c_str()); break;
+    case fITM: fmt = "ITM"; value = strprintf(" |%s| %s", get_itm_word(val).c_str(), get_bytes(val).c_str()); break;
+    case fLOG: fmt = "LOG"; value = strprintf("%llo", val);
+    }
+
+    Line line;
+    line.kind = Line::DATA;
+    line.addr = cur;
+    line.labeled = labels[cur].kind == Label::CODE;
+    line.op = fmt;
+    line.operand = json && value[0] == ' ' ? value.substr(1) : value;
+    listing.push_back(line);
+}
+
+void Dtran::populate_formats() {
+    for (uint cur = 011; cur < total_len; ++cur) {
+        if (code_map[cur])
+            continue;
+        if (gostoff.count(cur) && isooff.count(cur)) {
+            fprintf(stderr, "Make up your mind regarding offset %d (%#o)\n", cur, cur);
+        } else if (gostoff.count(cur)) {
+            format_map[cur] = fGOST;
+        } else if (itmoff.count(cur)) {
+            format_map[cur] = fITM;
+        } else if (isooff.count(cur)) {
+            format_map[cur] = fISO;
+        } else {
+            uint64 val = memory[cur];
+            int gost_score = 0; // gostoff.count(-cur) ? 0 : is_valid_gost(val);
+            int itm_score = 0; // itmoff.count(-cur) ? 0 : is_valid_itm(val);
+            int iso_score = isooff.count(-cur) ? 0 : is_valid_iso(val);
+            if (gost_score) 
+                gost_score += 2*is_likely_gost(val) +
+                    is_likely_gost(memory[cur-1]) +
+                    is_likely_gost(memory[cur+1]);
+    
+            if (itm_score)
+                itm_score += 2*is_likely_itm(val) +
+                    is_likely_itm(memory[cur-1]) +
+                    is_likely_itm(memory[cur+1]);
+
+            if (iso_score)
+                iso_score += 2*is_likely_iso(val) +
+                    is_likely_iso(memory[cur-1]) +
+                    is_likely_iso(memory[cur+1]);
+
+            if ((val >> 24) == 064000000 || (val >> 24) == 064377777) {
+                format_map[cur] = fINT;
+            } else if (gost_score && gost_score > iso_score) {
+                format_map[cur] = fGOST;                
+            } else if (iso_score && iso_score >= gost_score) {
+                format_map[cur] = fISO;
+            } else if (is_likely_text(memory[cur])) {
+                format_map[cur] = fTEXT;
+            } else {
+                format_map[cur] = is_likely_iso(memory[cur]) ? fISO : itm_score && val <=0xffffff ? fITM : fLOG;
+            }
+        }
+    }
+}
+
+void Dtran::prconst (bool litconst) {
+    for (uint cur = 011; cur < code_off; ++cur) {
+        pr1const(cur, litconst);
+    }
+}
+
+void Dtran::comment_line(const std::string & text) {
+    Line line;
+    line.kind = Line::COMMENT;
+    line.operand = text;
+    listing.push_back(line);
+}
+
+void
+Dtran::prtext (bool litconst)
+{
+    uint32 addr = code_off;
+    uint32 limit = total_len;
+    listing.clear();
+    if (nolabels) {
+        comment_line(" /:,BSS,");
+    }
+    for (; addr < limit; ++addr) {
+        if (addr % 64 == 0)
+            comment_line(strprintf("C ---------- %05o ----------", addr));
+        if (!code_map[addr] || isooff.count(addr) || gostoff.count(addr)) {
+          pr1const(addr, litconst);
+          continue;
+        }
+        uint64 opcode;
+        opcode = memory[addr];
+        prinsn (addr, opcode >> 24, false);
+        // Do not print the non-insn part of a word
+        // if it looks like a placeholder
+        bool addrmod = ((opcode >> 24) & 03600000) == 02200000;
+        opcode &= 0xffffff;
+        if ((opcode == 0 && !addrmod) || opcode == 02200000) {
+            opcode = memory[addr] >> 24;
+            opcode &= 03700000;
+            if (opcode != 03100000 &&
+                labels[addr+1].empty()) {
+                labels[addr+1].kind = Label::BLANK;
+            }
+        } else {
+            prinsn (addr, opcode, true);
+        }
+    }
+    if (normalize)
+        normalize_listing();
+    for (size_t i = 0; i < listing.size(); ++i)
+        prline(listing[i]);
+}
+/*
+ * Normalization of the decompilation (-d) output, formerly done by
+ * decomp.pl with regex substitutions over the whole program text.
+ *
+ * A rule is a sequence of instructions written as "reg,op,operand"
+ * and the instructions to replace it with. In a pattern, a leading ';'
+ * means the instruction must not be labeled, #N matches a decimal
+ * number, ?N a three-letter opcode and *N anything, binding it to $N
+ * for the replacement. The label of the first matched instruction goes
+ * to the first replacement.
+ */
+struct Rule {
+    const char * pat[2];
+    const char * repl[2];
+};
+
+static const Rule rules[] = {
+    // Normalizing references to addresses of globals
+    { { ";1,UTC,0", ";#1,VTM,#2" }, { "1,UTC,$2", "$1,VTM,0" } },
+    { { ";,UTC,#1", ";1,?2,0" }, { "1,$2,$1", 0 } },
+    { { ",UTC,#1", ";2,?2,0" }, { "2,$2,$1", 0 } },
+};
+
+/*
+ * A jump rule matches a jump and the instruction at its label further
+ * on, with a body between them, and rewrites both, inserting an
+ * instruction before each: before the jump, taking its label, and
+ * before the target, unlabeled. As the substitution decomp.pl repeated,
+ * the body is not empty, may hold data words but not a page comment,
+ * and a jump within the body of a rewrite is only taken after the jumps
+ * following that body, as is one to a label moved by a rewrite.
+ */
+struct JumpRule {
+    const char * jump, * target;
+    const char * repl[4];       // before the jump, the jump, before the target, the target
+};
+
+static const JumpRule jump_rules[] = {
+    // Converting for loops to the stack-friendly form: the loop variable
+    // store at the loop condition, jumped to from before the loop body,
+    //       ,UJ,X; body; X:R,ATX,Y
+    // becomes
+    //       R,ATX,Y; ,UJ,X; body; R,ATX,Y; X:R,XTA,Y
+    { ",UJ,*1", "*2,ATX,*3", { "$2,ATX,$3", ",UJ,$1", "$2,ATX,$3", "$2,XTA,$3" } },
+};
+
+// Splits "reg,op,operand" into its fields.
+static void split_insn(const char * s, std::string f[3]) {
+    for (int k = 0; k < 3; ++k) {
+        const char * e = k < 2 ? strchr(s, ',') : s + strlen(s);
+        f[k].assign(s, e);
+        s = e + 1;
+    }
+}
+
+static bool match_field(const std::string & pat, const std::string & text,
+                        std::string caps[10]) {
+    if (pat.size() == 2 && (pat[0] == '#' || pat[0] == '?' || pat[0] == '*')) {
+        if (pat[0] == '#' ? text.empty() ||
+            text.find_first_not_of("0123456789") != std::string::npos :
+            pat[0] == '?' && text.size() != 3)
+            return false;
+        caps[pat[1]-'0'] = text;
+        return true;
+    }
+    return pat == text;
+}
+
+static std::string subst_field(const std::string & repl, const std::string caps[10]) {
+    return repl.size() == 2 && repl[0] == '$' ? caps[repl[1]-'0'] : repl;
+}
+
+// Matches an instruction against a pattern, adding to the captures.
+static bool match_insn(const char * pat, const Dtran::Line & l, std::string caps[10]) {
+    std::string f[3];
+    if (l.kind != Dtran::Line::INSN || (*pat == ';' && l.labeled))
+        return false;
+    split_insn(pat + (*pat == ';'), f);
+    return match_field(f[1], l.op, caps) &&
+        match_field(f[0], l.reg ? strprintf("%d", l.reg) : "", caps) &&
+        match_field(f[2], l.operand, caps);
+}
+
+// Rewrites an instruction by a replacement; returns whether it changed.
+// A changed operand no longer refers to the label it did.
+static bool subst_insn(const char * repl, const std::string caps[10], Dtran::Line & l) {
+    std::string f[3];
+    split_insn(repl, f);
+    Dtran::Line old = l;
+    l.reg = atoi(subst_field(f[0], caps).c_str());
+    l.op = subst_field(f[1], caps);
+    l.operand = subst_field(f[2], caps);
+    if (l.operand != old.operand)
+        l.target = -1;
+    return l.reg != old.reg || l.op != old.op || l.operand != old.operand;
+}
+
+// The next instruction after listing[i], or listing.size().
+size_t Dtran::next_insn(size_t i) {
+    while (++i < listing.size() && listing[i].kind != Line::INSN)
+        ;
+    return i;
+}
+
+// Tries the rules on the instructions starting at listing[i];
+// returns true if one was applied.
+bool Dtran::apply_rules(size_t i) {
+    for (size_t r = 0; r < sizeof(rules)/sizeof(rules[0]); ++r) {
+        const Rule & rule = rules[r];
+        std::string caps[10];
+        size_t at[2];
+        int n = 0;
+        bool ok = true;
+        for (size_t k = i; n < 2 && rule.pat[n]; ++n, k = next_insn(k)) {
+            if (k >= listing.size() || !match_insn(rule.pat[n], listing[k], caps)) {
+                ok = false;
+                break;
+            }
+            at[n] = k;
+        }
+        if (!ok)
+            continue;
+        Line repl[2];
+        bool same = true;
+        for (int m = 0; m < n; ++m) {
+            repl[m] = listing[at[m]];
+            if (!rule.repl[m]) {
+                repl[m].kind = Line::DELETED;
+                same = false;
+            } else if (subst_insn(rule.repl[m], caps, repl[m]))
+                same = false;
+        }
+        if (same)
+            continue;
+        for (int m = 0; m < n; ++m)
+            listing[at[m]] = repl[m];
+        return true;
+    }
+    return false;
+}
+
+// Applies the jump rules in a single pass over the listing with a
+// worklist of the jumps, in order; the jumps held back by a rewrite
+// make the next round of the worklist. The inserted lines are kept
+// aside and merged in at the end.
+void Dtran::normalize_loops() {
+    if (nolabels)
+        return;
+    size_t n = listing.size();
+    std::vector<int> label_line(32768, -1);
+    std::vector<size_t> comments(n + 1, 0);
+    std::vector<std::vector<size_t> > jumps_to(n);
+    std::vector<size_t> work, held;
+    for (size_t i = 0; i < n; ++i) {
+        const Line & l = listing[i];
+        comments[i+1] = comments[i] + (l.kind == Line::COMMENT);
+        if (l.kind == Line::INSN && l.labeled)
+            label_line[l.addr] = i;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        const Line & l = listing[i];
+        if (l.kind != Line::INSN || l.target < 0 ||
+            labels[l.target].kind != Label::CODE || label_line[l.target] <= int(i))
+            continue;
+        jumps_to[label_line[l.target]].push_back(i);
+        work.push_back(i);
+    }
+    std::vector<std::vector<Line> > before(n);
+    while (!work.empty()) {
+        std::sort(work.begin(), work.end());
+        work.erase(std::unique(work.begin(), work.end()), work.end());
+        int done = -1;          // the end of the last rewrite
+        for (size_t w = 0; w < work.size(); ++w) {
+            size_t i = work[w];
+            if (int(i) <= done) {
+                held.push_back(i);
+                continue;
+            }
+            size_t j = label_line[listing[i].target];
+            if (j <= i + 1 || comments[j] != comments[i+1])
+                continue;
+            // The label may have moved to the line inserted before its own
+            bool moved = !listing[j].labeled;
+            Line & target = moved ? before[j].back() : listing[j];
+            for (size_t r = 0; r < sizeof(jump_rules)/sizeof(jump_rules[0]); ++r) {
+                const JumpRule & rule = jump_rules[r];
+                std::string caps[10];
+                if (!match_insn(rule.jump, listing[i], caps) ||
+                    !match_insn(rule.target, target, caps))
+                    continue;
+                Line jump = target;
+                jump.addr = listing[i].addr;
+                jump.right = listing[i].right;
+                jump.labeled = listing[i].labeled;
+                jump.inserted = true;
+                subst_insn(rule.repl[0], caps, jump);
+                Line pre = target;
+                pre.labeled = false;
+                pre.inserted = true;
+                subst_insn(rule.repl[2], caps, pre);
+                subst_insn(rule.repl[1], caps, listing[i]);
+                subst_insn(rule.repl[3], caps, target);
+                before[j].insert(before[j].end() - moved, pre);
+                // Going on after the target, which a moved label puts before j
+                done = moved ? j - 1 : j;
+                if (listing[i].labeled) {
+                    listing[i].labeled = false;
+                    held.insert(held.end(), jumps_to[i].begin(), jumps_to[i].end());
+                }
+                before[i].push_back(jump);
+                break;
+            }
+        }
+        work.swap(held);
+        held.clear();
+    }
+    std::vector<Line> result;
+    result.reserve(n + n / 8);
+    for (size_t i = 0; i < n; ++i) {
+        result.insert(result.end(), before[i].begin(), before[i].end());
+        result.push_back(listing[i]);
+    }
+    listing.swap(result);
+}
+
+void Dtran::normalize_listing() {
+    // Normalizing offsets. As decomp.pl did it on the text with the
+    // lines joined by ';', a comma followed by ';', at the end of a line
+    // not followed by a page comment or within a data text, gets a 0.
+    for (size_t i = 0; i < listing.size(); ++i) {
+        Line & l = listing[i];
+        if (l.kind == Line::COMMENT)
+            continue;
+        bool joined = i + 1 < listing.size() && listing[i+1].kind != Line::COMMENT;
+        std::string t = "," + l.operand + (joined ? ";" : "");
+        for (size_t k = 0; (k = t.find(",;", k)) != std::string::npos; k += 3)
+            t.insert(k + 1, "0");
+        t.erase(0, 1);
+        if (joined)
+            t.erase(t.size() - 1);
+        if (t != l.operand)
+            l.operand = t;
+        else if (joined && l.kind == Line::INSN && l.op == "UTM" && l.operand.size() == 5 &&
+                 l.operand.compare(0, 3, "327") == 0 &&
+                 l.operand.find_first_not_of("0123456789") == std::string::npos)
+            l.operand = strprintf("%d", atoi(l.operand.c_str()) - 32768);
+    }
+    normalize_loops();
+    // A single pass over the instructions; after a rewrite the rules
+    // are retried from the preceding instruction, as the rewritten one
+    // may complete a pattern starting there.
+    std::vector<size_t> work;
+    for (size_t i = next_insn(-1); i < listing.size(); ) {
+        if (apply_rules(i)) {
+            if (!work.empty()) {
+                i = work.back();
+                work.pop_back();
+            }
+            continue;
+        }
+        work.push_back(i);
+        i = next_insn(i);
+    }
+}
+
+struct opfields { uint reg; bool struc; int op; };
+
+static inline opfields decode(uint opcode) {
+    opfields ret;
+    ret.reg = opcode >> 20;
+    ret.struc = opcode & 02000000;
+    ret.op = (opcode >> 15) & 037;
+    return ret;
+}
+
+void Dtran::prsyms(uint cur, uint start) {
+    uint64 name = memory[start];
+    uint line = memory[start+1];
+    static const char * typestr[] = {
+        "real", "int", "char", "scalar", "array", "other", "file", "type 7"
+    };
+    if (json)
+        fprintf(out, "{\"routine\":%s,\"addr\":%u,\"line\":%u,\"vars\":[",
+                json_str(get_text_word(name)).c_str(), cur, line);
+    else
+    fprintf(out, "Routine %s @%05o, line %d:\n",
+           get_text_word(name).c_str(), cur, line);    
+    typedef std::map<int, std::pair<uint64, uint64> > syms_t;
+    syms_t syms;
+    for (uint addr = start+2; memory[addr]; addr += 2) {
+        syms[memory[addr+1] & 077777] =
+            std::make_pair(memory[addr], memory[addr+1]);
+    }
+    for (syms_t::iterator it = syms.begin(); it != syms.end(); ++it) {
+        uint64 flags = it->second.second;
+        int type = (flags >> 15) & 7;
+        int size = (flags >> 33);
+        int offset = flags & 077777;
+        if (json)
+            fprintf(out, "%s{\"name\":%s,\"size\":%d,\"offset\":%d,\"type\":\"%s\"}",
+                    it == syms.begin() ? "" : ",",
+                    json_str(get_text_word(it->second.first)).c_str(),
+                    size, offset, typestr[type]);
+        else
+        fprintf(out, "%s size %5o offset %05o - %s\n",
+               get_text_word(it->second.first).c_str(),
+               size, offset, typestr[type]);              
+    }
+    fprintf(out, json ? "]}\n" : "\tthat is all\n");
+}
+
+// Pascal-monitor symbol table, if present, is pointed to at the beginning
+// of each routine with "16 24 base 16 25 offset". This is unique enough.
+void Dtran::prsymtab() {
+    uint32 addr = code_off;
+    uint32 limit = total_len;
+    uint prev_insn = 0;
+    bool right = false;
+    for (uint32 cur = addr; cur < limit; cur += !right) {
+        uint insn = right ? memory[cur] & 0xffffff : memory[cur] >> 24;
+        if (decode(insn).reg == 016 && decode(insn).struc &&
+            decode(insn).op == 025 && decode(prev_insn).reg == 016 &&
+            decode(prev_insn).struc && decode(prev_insn).op == 024) {
+            uint start = (insn & 077777) + (prev_insn & 077777);
+            if (start >= addr && start < limit)
+                prsyms(cur, start);
+        }
+        prev_insn = insn;
+        right = !right;
+    }
+}
+
+Dtran::Dtran(const DtranOptions & o) :
+    basereg(o.basereg), baseaddr(~0u), nolabels(o.nolabels),
+    nooctal(o.nooctal), nodlabels(o.nodlabels), litconst(o.litconst), json(o.json),
+    normalize(o.normalize),
+    forced_code_off(o.forced_code_off), entries(o.entries),
+    gostoff(o.gostoff), itmoff(o.itmoff), isooff(o.isooff), textoff(o.textoff),
+    memory(32768), format_map(32768), labels(32768),
+    out(stdout), prev_addrmod(false)
+{
+    itm_to_utf();
+}
+
+bool Dtran::load(const char * fname) {
+    unsigned int addr = 02000;
+    struct stat st;
+
+    FILE * textfd = fopen (fname, "r");
+    if (! textfd) {
+        fprintf (stderr, "dtran: %s not found\n", fname);
+        return false;
+    }
+    stat (fname, &st);
+    uint codelen = st.st_size / 6;
+
+    if (codelen >= 32768) {
+        fprintf(stderr, "File too large\n");
+        fclose (textfd);
+        return false;
+    }
+    while (!feof(textfd) && addr < 0100000) {
+        memory[addr++] = freadw (textfd);
+    }
+    fclose (textfd);
+    return analyze(codelen, addr);
+}
+
+bool Dtran::load(const uint64 * words, uint len) {
+    if (len >= 32768 - 02000) {
+        fprintf(stderr, "File too large\n");
+        return false;
+    }
+    std::copy(words, words + len, memory.begin() + 02000);
+    return analyze(len, 02000 + len);
+}
+
+bool Dtran::analyze(uint codelen, uint addr) {
+    fill_lengths();
+    if (codelen + addr < total_len) {
+        fprintf(stderr, "File was too short: %d, expected %d\n", codelen, total_len);
+        return false;
+    }
+
+    while (memory[total_len-1] == 0) --total_len;
+
+    symtab.resize(04000);
+    label_patterns();
+#if 0
+    symtab[031] = "P/WOLN";
+    symtab[034] = "P/MD";
+    symtab[047] = "P/7A";
+    symtab[055] = "P/RC";
+    symtab[0100] = "P/A7";
+    symtab[0101] = "P/WC";
+    symtab[0102] = "P/6A";
+    symtab[0104] = "P/WI";
+    symtab[0110] = "P/IN";
+    symtab[0111] = "P/SS";
+    symtab[0057] = "P/TR"; // trunc
+    symtab[0141] = "P/TR"; // trunc, same as 0057
+    symtab[0136] = "P/0060"; // signed mult. correction
+    symtab[0222] = "P/0026"; // get(input)
+    symtab[0257] = "P/0030"; // put(output)
+    symtab[0313] = "P/0032"; // rewrite(output)
+    symtab[0337] = "P/0033"; // unpck
+    symtab[0173] = "P/0023"; // pck
+    symtab[0715] = "P/0040"; // put
+    symtab[0760] = "P/0041"; // get
+    symtab[0202] = "P/0024"; // intToReal, a no-op in P-M
+    symtab[01675] = "P/0066"; // bind
+    symtab[01361] = "P/0050"; // mapia
+#endif
+    populate_formats();
+    for (cfg_t::iterator it = cfg.begin(); it != cfg.end(); ++it) {
+        uint end = std::min(it->second.end, total_len);
+        for (uint32 cur = std::max(it->first, code_off); cur < end; ++cur) {
+            uint64 & opcode = memory[cur];
+            mklabels(cur, opcode >> 24, litconst);
+            mklabels(cur, opcode & 0xffffff, litconst);
+        }
+    }
+    return true;
+}
+
+void Dtran::print(FILE * f) {
+    out = f;
+    prev_addrmod = false;
+    prheader();
+    // prconst(litconst);
+    prtext(litconst);
+    prsymtab();
+    if (!json)
+        fprintf(out, " ,END,\n");
+}
+
+void Dtran::label_patterns() {
+  /* Register saving subroutine level N is 4 distinctive words:
+   *  00037000300420007LL,   ,NTR, 3       ,ITA, 7
+   *  07444000774440002LL, 15,MTJ, 7     15,MTJ, N
+   *  00043001500430001LL,   ,ITS, 13      ,ITS, N-1
+   *  03400000273000000LL,  7,ATX, 2     14, UJ,
+   */
+    uint64 psav[] = {
+        00037000300420007LL,
+        07444000774440000LL,
+        00043001500430000LL,
+        03400000273000000LL
+    };
+    uint min_pattern = 077777;
+    for (int i = 2; i <= 6; ++i) {
+        psav[1] = (psav[1] & ~7LL) | i;
+        psav[2] = (psav[2] & ~7LL) | (i-1);
+        std::string name = std::string("P/") +char('0'+i);
+        uint addr = label_pattern(psav, sizeof(psav), name);
+        if (addr != 0100000)
+            fprintf(stderr, "Address of %s is %05o\n", name.c_str(), addr);
+        if (addr < min_pattern) min_pattern = addr;
+    }
+    /* Register restoring subroutine from M to N, 2 <= M < N <= 6
+     * has a sequence of level-by-level restoring insns,
+     * ending with return insns. The max is from level 2 to level 6 = 5 words.
+     */
+    uint64 pret[5];
+    uint64 first = 05444000000100002LL; // 11,MTJ,N   N,XTA,2
+    uint64 mid =   00040000000100002LL; //   ,ATI,K   K,XTA,2
+    uint64 last =  00040000073000000LL; //   ,ATI,M  14, UJ,
+
+    for (uint64 m = 2; m < 6; ++m)
+        for (uint64 n = m+1; n <= 6; ++n) {
+            int p = 0;
+            pret[p++] = first | (n << 24) | (n<<20);
+            for (uint64 k = n-1; k > m; --k)
+                pret[p++] = mid | (k << 24) | (k<<20);
+            pret[p++] = last | (m<<24);
+            uint addr = label_pattern(pret, p*sizeof(uint64),
+                                      (std::string("P/") + char('0'+n))+char('0'+m));
+            if (addr < min_pattern) min_pattern = addr;            
+        }
+    uint64 pe[] = {
+        07657777676300001LL, // 15,UTM,-2   15,WTC,1
+        00300000002200000LL  //  ,UJ,
+    };
+    
+    uint64 pef[] = {
+        03410000100360117LL, // 7,XTA,1     ,ASN,64+15
+        00040001672200000LL, //  ,ATI,14  14,UTC,
+        06710000002200000LL // 13,VJM,
+    };
+    uint addr = label_pattern(pef, 3*sizeof(uint64), "P/EF");
+    if (addr < min_pattern) 
+        min_pattern = addr;
+    if (addr != 0100000) {
+        name_label(addr + 3, "P/E");
+        fprintf(stderr, "Address of P/E is %05o\n", addr + 3);
+    }
+
+    uint64 p1d[] = { 0, 0, 0, 0, 0, 0, 0,
+      01403006014030060LL,
+    };
+    addr = label_pattern(p1d, 8*sizeof(uint64), "P/1D");
+    if (addr < min_pattern) 
+        min_pattern = addr;
+    fprintf(stderr, "Address of P/1D is %05o\n", addr);
+
+    code_len = min_pattern;
+    fprintf(stderr, "User code ends @%05o\n", code_len);
+}
+
+uint Dtran::label_pattern(void * pattern, size_t size, std::string name) {
+    uint64* where = (uint64*)memmem(&memory[0], sizeof(memory[0])*total_len, pattern, size);
+    if (where) name_label(where-&memory[0], name);
+    return where ? where-&memory[0] : 0100000;
+}
@@ -0,0 +1,150 @@
+#!/usr/bin/env perl
+# Compiles the Pascal modules listed in a manifest, several at a time,
+# by one run of the compiler: pascompl -B list -jN -T.
+#
+# Usage: pasbuild.pl [-c compiler] [-j jobs] [-f] manifest
+#
+# Each line of the manifest holds the pascompl arguments for a module:
+#   [option...] source.pas [object]
+# the object defaulting to the source name with .obj for .pas.
+# Options are written with their values attached, as -l2.
+# Empty lines and lines starting with # are skipped.
+#
+# A module is compiled only if the source, the options or the compiler
+# have changed since it was last built, or if the object is missing;
+# the hashes are kept in manifest.hash. -f rebuilds everything.
+# The modules start from the state of the compiler saved in
+# manifest.snap (-S), unless given -S of their own.
+# The time taken by each compilation is reported; the listing of
+# a failed module is printed after its line. Should the compiler stop
+# on some module, the modules it has not reported are compiled again
+# one at a time.
+
+use strict;
+use Getopt::Std;
+use Digest::SHA;
+use Time::HiRes qw(time);
+use File::Temp qw(tempfile);
+
+my %opts;
+getopts('c:j:f', \%opts) && @ARGV == 1
+    or die "Usage: $0 [-c compiler] [-j jobs] [-f] manifest\n";
+my $compiler = $opts{c} || './pascompl';
+my $jobs = $opts{j} || `getconf _NPROCESSORS_ONLN` || 1;
+chomp $jobs;
+my $manifest = $ARGV[0];
+my $hashfile = "$manifest.hash";
+my $snapfile = "$manifest.snap";
+
+sub filehash {
+    my ($name) = @_;
+    my $sha = Digest::SHA->new(256);
+    -r $name or return undef;
+    $sha->addfile($name, 'b');
+    return $sha->hexdigest;
+}
+
+my $comphash = filehash($compiler)
+    or die "$0: Cannot read compiler $compiler\n";
+
+# Previous state: object name => hash
+my %built;
+if (open(H, '<', $hashfile)) {
+    while (<H>) {
+        my ($hash, $obj) = /^(\S+) (.*)$/ or next;
+        $built{$obj} = $hash;
+    }
+    close(H);
+}
+
+my (@todo, %want);
+open(M, '<', $manifest) or die "$0: Cannot open $manifest: $!\n";
+while (<M>) {
+    my @args = split;
+    next if !@args || $args[0] =~ /^#/;
+    my @flags = grep { /^-/ } @args;
+    my @files = grep { !/^-/ } @args;
+    if (@files < 1 || @files > 2) {
+        die "$manifest:$.: Need a source and an optional object\n";
+    }
+    my ($src, $obj) = @files;
+    ($obj = $src) =~ s/(\.pas)?$/.obj/ unless defined $obj;
+    my $srchash = filehash($src)
+        or die "$manifest:$.: Cannot read $src\n";
+    my $hash = Digest::SHA::sha256_hex(join("\0", $comphash, $srchash, @flags));
+    $want{$obj} = $hash;
+    if (!$opts{f} && -f $obj && defined $built{$obj} && $built{$obj} eq $hash) {
+        next;
+    }
+    delete $built{$obj};
+    push @flags, "-S$snapfile" unless grep { /^-S/ } @flags;
+    push @todo, { src => $src, obj => $obj, args => [@flags, $src, $obj], hash => $hash };
+}
+close(M);
+
+my $uptodate = keys(%want) - @todo;
+my $failed = 0;
+my $start = time;
+
+# Reports a module: its time, or FAILED and its listing.
+sub finish {
+    my ($unit, $status, $elapsed) = @_;
+    if ($status eq 'DONE') {
+        $built{$unit->{obj}} = $unit->{hash};
+        printf "%8.3fs  %s\n", $elapsed, $unit->{obj};
+    } else {
+        ++$failed;
+        printf "%8.3fs  %s FAILED\n", $elapsed, $unit->{obj};
+        print $unit->{log};
+    }
+}
+
+# Compiles the units by one run of the compiler. The listings come in
+# the order of the list, each followed by the line of its unit.
+# Returns the units not reported, lost with the compiler, and why.
+sub batch {
+    my ($units, $jobs) = @_;
+    my ($fh, $list) = tempfile();
+    print $fh join(' ', @{$_->{args}}), "\n" for @$units;
+    close($fh);
+    open(C, '-|', $compiler, '-B', $list, "-j$jobs", '-T')
+        or die "$0: Cannot run $compiler: $!\n";
+    my ($log, $next) = ('', 0);
+    while (<C>) {
+        if (/^ UNIT (\d+): (DONE|FAILED), ([\d.]+) SEC$/ && $1 == $next + 1) {
+            $units->[$next]->{log} = $log;
+            finish($units->[$next++], $2, $3);
+            $log = '';
+        } else {
+            $log .= $_;
+        }
+    }
+    close(C);
+    unlink($list);
+    my $why = $? & 127 ? "killed by signal " . ($? & 127) : "stopped";
+    return ($why, @$units[$next .. $#$units]);
+}
+
+# The units lost in a batch are compiled again one at a time, not to
+# fail the others with the one that stops the compiler.
+if (@todo) {
+    my ($why, @lost) = batch(\@todo, $jobs);
+    for my $unit (@lost) {
+        ($why, my @again) = batch([$unit], 1);
+        next unless @again;
+        $unit->{log} = "$compiler $why\n";
+        finish($unit, 'FAILED', 0);
+    }
+}
+
+# Only the modules still in the manifest are remembered
+open(H, '>', "$hashfile.tmp") or die "$0: Cannot write $hashfile: $!\n";
+for my $obj (sort keys %built) {
+    print H "$built{$obj} $obj\n" if defined $want{$obj};
+}
+close(H);
+rename("$hashfile.tmp", $hashfile);
+
+printf "%d compiled, %d up to date, %d failed in %.3fs\n",
+    keys(%want) - $uptodate - $failed, $uptodate, $failed, time - $start;
+exit($failed != 0);
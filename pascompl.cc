@@ -7,11 +7,12 @@
  * "unpacked" form: the section lengths occupied one word each.
  * It was the job of the monitor system to pack it before putting
  * into the temporary/personal library.
+ * With -B listfile, the units listed in the file are compiled in one process,
+ * with -jN in N threads.
  */
 #include <cstdio>
 #include <string>
 #include <vector>
-#include <map>
 #include <cstdlib>
 #include <stdint.h>
 #include <cmath>
@@ -19,19 +20,32 @@
 #include <sstream>
 #include <wctype.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include <cassert>
-#include <set>
-
-FILE * pasinput = stdin;
-unsigned char PASINPUT;
-const char *outFileName = "output.obj";
+#include <algorithm>
+#include <deque>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <stdexcept>
+
+// The compiler state is kept per thread, see compileBatch().
+thread_local FILE * pasinput = stdin;
+thread_local FILE * listing = stdout;
+thread_local unsigned char PASINPUT;
+thread_local std::string srcText;    // the whole source in KOI-8
+thread_local size_t srcPos;
+thread_local bool srcEOF;
+thread_local int eofCnt;
+thread_local const char *outFileName = "output.obj";
+thread_local const char *snapFileName;       // the initial state, see loadSnapshot()
 
 const char * boilerplate = "Pascal-Monitor in C++ (17.05.2019)";
 
-const int MAXLIT = 500;
 const int SYMTAB_LIMIT = 077777; // initially 075500
-const int SYMTAB_MAX = 1000; // initially 80
 const int OBJBUF_SIZE = 8192;    // initially 1024
+const int HASH_BITS = 10;        // the identifier tables, initially 128 entries
+const int HASH_SIZE = 1 << HASH_BITS;
 
 const int64_t
     fnSQRT  = 0,  fnSIN  = 1,  fnCOS  = 2,  fnATAN  = 3,  fnASIN = 4,
@@ -204,7 +218,7 @@ enum OpGen {
     gen0,  STORE, LOAD,  LOOPCOND,  SETREG,
     ADDRTOR9,  STRUCTASSN,  APPLYEXPR,  ADDRTOR12,  MKINT,
     MKPUSH, gen11, gen12, FILEACCESS, FILEINIT,
-    CONDJUMP, PCKUNPCK, LITINSN
+    CONDJUMP, PCKUNPCK, LITINSN, ADDRTOREG
 };
 
 // Flags for ops that can potentially be optimized if one operand is a constant
@@ -322,6 +336,12 @@ struct Real {
         double mant = frexp(d, &exp);
         mantissa = ldexp(mant, 40);
         exponent = exp + 64;
+        if (mant == 0)
+            exponent = 0;
+        else if (mant == -0.5) { // -1/2 is not normalized, -1 is
+            mantissa = mantissa * 2;
+            exponent = exponent - 1;
+        }
     }
 };
 
@@ -332,23 +352,174 @@ std::string Real::print() const
     return ostr.str();
 }
 
-int64_t heap[32768];
-int64_t avail = 100;
+// The real arithmetic of the BESM-6 in the mode the compiled code uses
+// (NTR 0): the results are normalized, and rounded by setting the lowest
+// bit of the mantissa if nonzero bits have gone below it. A result is held
+// in v as the mantissa with 40 more bits below it; the functions return
+// false on the exponent overflow, which traps at run time.
+bool besm6Round(Real & res, __int128 v, int64_t exp, bool round)
+{
+    const __int128 top = __int128(1) << 80;
+    while (v >= top or v < -top) {
+        round = round or ((v >> 40) & 1);
+        v >>= 1;
+        ++exp;
+    }
+    if (v == 0) {
+        res.mantissa = 0;
+        res.exponent = 0;
+        return true;
+    }
+    while ((v >> 79) == 0 or (v >> 79) == -1) {
+        v *= 2;
+        --exp;
+    }
+    if (exp < 0) {      // underflow gives zero
+        res.mantissa = 0;
+        res.exponent = 0;
+        return true;
+    }
+    if (exp > 127)
+        return false;
+    res.mantissa = int64_t(v >> 40) | (round ? 1 : 0);
+    res.exponent = exp;
+    return true;
+}
+
+// The smaller operand is shifted right to align the exponents; the bits
+// going below the mantissa ask for the rounding.
+bool besm6Add(Real & res, Real a, Real b, bool negate)
+{
+    int64_t ma = a.mantissa, mb = negate ? -int64_t(b.mantissa) : b.mantissa;
+    int64_t diff;
+    bool round;
+
+    if (a.exponent < b.exponent) {
+        std::swap(a, b);
+        std::swap(ma, mb);
+    }
+    diff = a.exponent - b.exponent;
+    if (diff <= 40)
+        round = (mb & ((1L << diff) - 1)) != 0;
+    else
+        round = mb != 0;
+    return besm6Round(res, __int128(ma) * (1L << 40) +
+                      ((__int128(mb) * (1L << 40)) >> std::min(diff, 100L)),
+                      a.exponent, round);
+}
+
+bool besm6Neg(Real & res, Real a)
+{
+    return besm6Round(res, -__int128(a.mantissa) * (1L << 40), a.exponent, false);
+}
+
+// The lower half of the product asks for the rounding.
+bool besm6Mul(Real & res, Real a, Real b)
+{
+    __int128 prod = __int128(a.mantissa) * b.mantissa;
+    if (prod == 0) {
+        res.mantissa = 0;
+        res.exponent = 0;
+        return true;
+    }
+    return besm6Round(res, prod, int64_t(a.exponent) + b.exponent - 64,
+                      (prod < 0 ? -prod : prod) & ((__int128(1) << 40) - 1));
+}
+
+// The quotient is not rounded: it is taken by the floor, as a mantissa
+// shifted right is, with 79 more bits, so that it is never shifted
+// right itself. A divisor that is not normalized traps.
+bool besm6Div(Real & res, Real a, Real b)
+{
+    int64_t mb = b.mantissa;
+    __int128 num, quot;
+    if ((mb >> 39) == 0 or (mb >> 39) == -1)
+        return false;
+    num = __int128(a.mantissa) * (__int128(1) << 79);
+    quot = num / mb;
+    if (num % mb != 0 and (num < 0) != (mb < 0))
+        --quot;
+    return besm6Round(res, quot, int64_t(a.exponent) - b.exponent + 65, false);
+}
+
+// The heap was 32768 words, the first segment now. The address space
+// for HEAP_LIMIT words is reserved at once, so that the objects never
+// move and the later ones have the higher addresses, which exitScope()
+// relies upon; it is made accessible a segment at a time.
+const int64_t HEAP_SEGMENT = 32768;
+const int64_t HEAP_LIMIT = 128 * HEAP_SEGMENT;
+
+thread_local int64_t * heap;
+thread_local int64_t heapTop;       // the words accessible
+thread_local int64_t avail = 100;
+thread_local int64_t availPeak;    // the high-water mark of avail
+
+// Maps the heap if needed, and empties it.
+void clearHeap()
+{
+    if (heap == NULL) {
+        void * p = mmap(NULL, HEAP_LIMIT * sizeof(int64_t), PROT_NONE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (p == MAP_FAILED) {
+            perror("heap");
+            throw std::bad_alloc();
+        }
+        heap = static_cast<int64_t *>(p);
+        heapTop = 0;
+    }
+    if (heapTop > HEAP_SEGMENT) {
+        // Given back to the system, to be read as zeros if used again
+        madvise(heap + HEAP_SEGMENT, (heapTop - HEAP_SEGMENT) * sizeof(int64_t), MADV_DONTNEED);
+        mprotect(heap + HEAP_SEGMENT, (heapTop - HEAP_SEGMENT) * sizeof(int64_t), PROT_NONE);
+        heapTop = HEAP_SEGMENT;
+    }
+    if (heapTop == 0) {
+        mprotect(heap, HEAP_SEGMENT * sizeof(int64_t), PROT_READ | PROT_WRITE);
+        heapTop = HEAP_SEGMENT;
+    } else
+        memset(heap, 0, heapTop * sizeof(int64_t));
+    avail = availPeak = 100;
+}
+
+void freeHeap()
+{
+    if (heap != NULL)
+        munmap(heap, HEAP_LIMIT * sizeof(int64_t));
+    heap = NULL;
+    heapTop = 0;
+}
 
 void * besm6_alloc(size_t s)
 {
     s = (s + 7) & ~7;
     s /= sizeof(int64_t);
-    if (avail + s > 32768) {
-        fprintf(stderr, "Out of memory: avail = %ld, wants %lu words\n", avail, s);
-        throw std::bad_alloc();
+    // 074000 stands for NIL in ord()
+    if (avail <= 074000 && avail + int64_t(s) > 074000)
+        avail = 074000 + 1;
+    if (avail + int64_t(s) > heapTop) {
+        int64_t top = (avail + s + HEAP_SEGMENT - 1) / HEAP_SEGMENT * HEAP_SEGMENT;
+        if (top > HEAP_LIMIT ||
+            mprotect(heap + heapTop, (top - heapTop) * sizeof(int64_t),
+                     PROT_READ | PROT_WRITE) != 0) {
+            fprintf(stderr, "Out of memory: avail = %ld, wants %lu words\n", avail, s);
+            throw std::bad_alloc();
+        }
+        heapTop = top;
     }
     avail += s;
+    if (avail > availPeak)
+        availPeak = avail;
     return heap + avail - s;
 }
 
+// The heap found corrupted fails the unit being compiled, as its
+// exhaustion does (compileUnit).
+struct HeapError : std::logic_error {
+    HeapError() : std::logic_error("heap corrupted") { }
+};
+
 // Dynamic allocation in the compiler expects that the pointer can be represented as
-// a 15-bit word offset into the memory pool. Deallocation is never used explicitly;
+// a word offset into the memory pool; it was 15-bit. Deallocation is never used explicitly;
 // instead, the heap high watermark is saved at the start of a scope and rolled down
 // at its end.
 struct BESM6Obj {
@@ -356,7 +527,10 @@ struct BESM6Obj {
         return besm6_alloc(s);
     }
 
-    void operator delete(void *); // deliberately undefined
+    // The objects go with the heap; the new expressions refer to this
+    // only to free an object whose constructor throws, and the heap
+    // is rolled back then as well.
+    void operator delete(void *) { }
 };
 
 template<class T> void setup(T * &p)
@@ -373,12 +547,12 @@ void rollup(void * p)
 {
     if (p < heap || p > heap + avail) {
         fprintf(stderr, "Cannot rollup from %p to %p\n", (void*)(heap + avail), p);
-        exit(1);
+        throw HeapError();
     }
     avail = reinterpret_cast<int64_t*>(p) - heap;
     if (heap + avail != p) {
         fprintf(stderr, "Cannot rollup to unaligned pointer %p\n", p);
-        exit(1);
+        throw HeapError();
     }
 }
 
@@ -389,7 +563,7 @@ void * ptr(int64_t x)
     if (x == 074000) return NULL;
     if (x < 0 || x >= avail) {
         fprintf(stderr, "Cannot convert %ld to a pointer, avail = %ld\n", x, avail);
-        exit(1);
+        throw HeapError();
     }
     return heap + x;
 }
@@ -402,11 +576,11 @@ int64_t ord(void * p)
     if (p < heap || p >= heap + avail) {
         fprintf(stderr, "Invalid pointer to integer conversion, %p is outside of valid heap range %p-%p\n",
                 p, (void*)heap, (void*)(heap + avail));
-        exit(1);
+        throw HeapError();
     }
     if (heap + (reinterpret_cast<int64_t*>(p) - heap) != p) {
         fprintf(stderr, "Unaligned pointer to integer conversion: %p\n", p);
-        exit(1);
+        throw HeapError();
     }
     return reinterpret_cast<int64_t*>(p) - heap;
 }
@@ -656,13 +830,91 @@ void p(ExprPtr e) {
     fprintf(stderr, "%s\n", e->p().c_str());
 }
 
-struct KeyWord : public BESM6Obj {
-    Word w;
-    Symbol sym;
-    Operator op;
-    KeyWord * next;
+// The reserved words, TEXT-coded, with their symbols and operators.
+struct KeyWord {
+    int64_t w = 0;      // 0 for a free slot
+    Symbol sym = IDENT;
+    Operator op = NOOP;
 };
 
+constexpr KeyWord keyWords[] = {
+    { 0415644L,           MULOP,      AMPERS }, /*"     AND"*/
+    { 0445166L,           MULOP,      IDIVOP }, /*"     DIV"*/
+    { 0555744L,           MULOP,      IMODOP }, /*"     MOD"*/
+    { 0565154L,           GTSY,       NOOP },   /*"     NIL", GTSY reused as NILSY */
+    { 05762L,             ADDOP,      OROP },   /*"      OR"*/
+    { 05156L,             RELOP,      INOP },   /*"      IN"*/
+    { 0565764L,           NOTSY,      NOOP },   /*"     NOT"*/
+    { 05441424554L,       LABELSY,    NOOP },   /*"   LABEL"*/
+    { 04357566364L,       CONSTSY,    NOOP },   /*"   CONST"*/
+    { 064716045L,         TYPESY,     NOOP },   /*"    TYPE"*/
+    { 0664162L,           VARSY,      NOOP },   /*"     VAR"*/
+    { 04665564364515756L, FUNCSY,     NOOP },   /*"FUNCTION"*/
+    { 06062574345446562L, PROCSY,     NOOP },   /*"PROCEDUR"*/
+    { 0634564L,           SETSY,      NOOP },   /*"     SET"*/
+    { 0604143534544L,     PACKEDSY,   NOOP },   /*"  PACKED"*/
+    { 04162624171L,       ARRAYSY,    NOOP },   /*"   ARRAY"*/
+    { 0624543576244L,     RECORDSY,   NOOP },   /*"  RECORD"*/
+    { 046515445L,         FILESY,     NOOP },   /*"    FILE"*/
+    { 04245475156L,       BEGINSY,    NOOP },   /*"   BEGIN"*/
+    { 05146L,             IFSY,       NOOP },   /*"      IF"*/
+    { 043416345L,         CASESY,     NOOP },   /*"    CASE"*/
+    { 0624560454164L,     REPEATSY,   NOOP },   /*"  REPEAT"*/
+    { 06750515445L,       WHILESY,    NOOP },   /*"   WHILE"*/
+    { 0465762L,           FORSY,      NOOP },   /*"     FOR"*/
+    { 067516450L,         WITHSY,     NOOP },   /*"    WITH"*/
+    { 047576457L,         GOTOSY,     NOOP },   /*"    GOTO"*/
+    { 0455644L,           ENDSY,      NOOP },   /*"     END"*/
+    { 045546345L,         ELSESY,     NOOP },   /*"    ELSE"*/
+    { 06556645154L,       UNTILSY,    NOOP },   /*"   UNTIL"*/
+    { 05746L,             OFSY,       NOOP },   /*"      OF"*/
+    { 04457L,             DOSY,       NOOP },   /*"      DO"*/
+    { 06457L,             TOSY,       NOOP },   /*"      TO"*/
+    { 0445767566457L,     DOWNTOSY,   NOOP },   /*"  DOWNTO"*/
+    { 064504556L,         THENSY,     NOOP },   /*"    THEN"*/
+    { 0634554454364L,     SELECTSY,   NOOP },   /*"  SELECT"*/
+    { 060625747624155L,   PROGRAMSY,  NOOP },   /*" PROGRAM"*/
+    { 0576450456263L,     OTHERSY,    NOOP }    /*"  OTHERS"*/
+};
+
+// The keywords are found by a perfect hash: the word times a multiplier
+// chosen at build time, the top KW_BITS bits of the product taken.
+const int KW_BITS = 7;
+
+constexpr int kwSlot(uint64_t w, uint64_t mult)
+{
+    return (w * mult) >> (64 - KW_BITS);
+}
+
+constexpr bool kwPerfect(uint64_t mult)
+{
+    bool used[1 << KW_BITS] = { };
+    for (const KeyWord & k : keyWords) {
+        if (used[kwSlot(k.w, mult)])
+            return false;
+        used[kwSlot(k.w, mult)] = true;
+    }
+    return true;
+}
+
+constexpr uint64_t kwMultiplier()
+{
+    uint64_t mult = 0x9E3779B97F4A7C15ULL;
+    while (!kwPerfect(mult))
+        mult = (mult * 6364136223846793005ULL + 1442695040888963407ULL) | 1;
+    return mult;
+}
+
+constexpr uint64_t KW_MULT = kwMultiplier();
+
+constexpr struct KeyWordTab {
+    KeyWord slot[1 << KW_BITS];
+    constexpr KeyWordTab() : slot() {
+        for (const KeyWord & k : keyWords)
+            slot[kwSlot(k.w, KW_MULT)] = k;
+    }
+} keyWordTab;
+
 struct StrLabel : public BESM6Obj {
     StrLabel * next;
     int64_t ident;
@@ -807,27 +1059,27 @@ enum numberSuffix { noSuffix, suffixB, suffixT, suffixC};
 
 // Globals
 
-numberSuffix suffix;
-SetOfSYs   bigSkipSet, statEndSys, blockBegSys, statBegSys,
+thread_local numberSuffix suffix;
+thread_local SetOfSYs   bigSkipSet, statEndSys, blockBegSys, statBegSys,
            skipToSet, lvalOpSet;
 
-bool   bool47z, bool48z, bool49z;
-bool   dataCheck;
+thread_local bool   bool47z, bool48z, bool49z;
+thread_local bool   dataCheck;
 
-int64_t jumpType, jumpTarget, int53z;
+thread_local int64_t jumpType, jumpTarget, int53z;
 
-Operator charClass;
-Symbol   SY, prevSY;
+thread_local Operator charClass;
+thread_local Symbol   SY, prevSY;
 
-int64_t savedObjIdx,
+thread_local int64_t savedObjIdx,
         FcstCnt,
         symTabPos,
         entryPtCnt,
         fileBufSize;
 
-ExprPtr expr62z, expr63z;
+thread_local ExprPtr expr62z, expr63z;
 
-int64_t curInsnTemplate,
+thread_local int64_t curInsnTemplate,
         maxLineLen,
         linePos,
         prevErrPos,
@@ -844,15 +1096,14 @@ int64_t curInsnTemplate,
         heapSize,
         arithMode;
 
-std::string stmtName;
-KeyWord * keyWordHashPtr;
-Kind curVarKind;
-ExtFileRec * curExternFile;
-char commentModeCH;
-unsigned char CH;
-Word prevInsn;
+thread_local std::string stmtName;
+thread_local Kind curVarKind;
+thread_local ExtFileRec * curExternFile;
+thread_local char commentModeCH;
+thread_local unsigned char CH;
+thread_local Word prevInsn;
 
-int64_t debugLine,
+thread_local int64_t debugLine,
         lineNesting,
         FcstTotal,
         objBufIdx,
@@ -861,7 +1112,7 @@ int64_t debugLine,
         charEncoding,
         int97z;
 
-bool atEOL,
+thread_local bool atEOL,
     checkTypes,
     isDefined, putLeft, fetch,
     errors,
@@ -876,95 +1127,256 @@ bool atEOL,
     allowCompat,
     checkFortran;
 
-int verbose;
+thread_local int verbose;
+
+// The report of -T: the time taken by the phases, in seconds, and the
+// use of the tables. The hash chains are counted when the tables
+// hold the most identifiers, before a scope is left.
+const int CHAIN_HIST = 9;       // chains of 0..7 and of 8 or more
+struct Stats {
+    double setup, lexing, parsing, codegen, finalize, output;
+    int64_t tokens, idents, literals, symbols, objBufPeak;
+    int64_t names, types;       // in the tables when the chains were counted
+    int64_t nameChains[CHAIN_HIST], typeChains[CHAIN_HIST];
+};
+thread_local bool showStats;
+thread_local Stats stats;
+
+double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Adds the time spent in its scope to a phase of the report; the
+// scopes nested in it are counted with it.
+struct PhaseTimer {
+    static thread_local double * timing;    // the phase being timed
+    double * phase;
+    std::chrono::steady_clock::time_point start;
+    PhaseTimer(double & p) : phase(NULL) {
+        if (showStats and timing == NULL) {
+            phase = timing = &p;
+            start = std::chrono::steady_clock::now();
+        }
+    }
+    ~PhaseTimer() {
+        if (phase != NULL) {
+            *phase += secondsSince(start);
+            timing = NULL;
+        }
+    }
+};
+thread_local double * PhaseTimer::timing;
+
+// The case statement dispatch: 0 - chosen by the labels,
+// 1 - compare chain (a table for labels with no gaps),
+// 2 - decision tree, 3 - jump table
+thread_local int64_t caseMode;
+
+// A for loop whose control variable is known to stay within [lo, hi]
+// while the body runs, unless the body assigns it (threats).
+// uses counts the range checks dropped on the strength of it.
+struct LoopRange {
+    IdentRecPtr var;
+    int64_t lo, hi;
+    int64_t depth, labels;      // condLoopDepth and labelsSeen at the loop
+    int64_t uses, threats;
+};
+thread_local std::vector<LoopRange> loopRanges;
+// While and repeat loops being compiled, labels defined so far
+thread_local int64_t condLoopDepth, labelsSeen;
+
+// The control variable of a for loop being compiled, with the frame
+// temporaries holding its products by the element sizes of the arrays
+// it indexes. They step with it; an assignment to the variable
+// (threats) makes them recomputed after the statement (stale).
+struct InductionVar {
+    IdentRecPtr var;
+    int64_t threats;
+    bool stale;
+    std::vector<std::pair<int64_t,int64_t>> temps;  // factor, offset
+};
+thread_local std::vector<InductionVar> inductionVars;
+// Multiplications and divisions by constants with additions and the
+// exponent, the products of for loop variables in temporaries
+thread_local bool reduceOps;
+// Jumps to unconditional jumps sent on to where these go (threadJumps)
+thread_local bool threadCode;
+
+// The routines expanded in place of their calls: a single assignment
+// making up the body, of the function value or through a var parameter,
+// with no calls, in no more than inlineLimit words of code. The body
+// is kept in inlineNodes, out of the heap that is rolled back after
+// each statement.
+struct InlineBody {
+    IdentRecPtr routine;
+    ExprPtr body;               // the value for a function
+};
+thread_local std::vector<InlineBody> inlineBodies;
+thread_local std::deque<Expr> inlineNodes;
+thread_local ExprPtr inlineCand;        // the body being compiled
+thread_local int64_t inlineLimit, stmtCount;
+// Routines expanded since the last line listed, with the lines
+// of their calls, noted in the listing
+thread_local std::vector<std::pair<IdentRecPtr, int64_t>> inlinedHere;
+
+// A loop being compiled, for the addresses it keeps in index registers
+// (hoistLoops): those of array elements and pointed-to variables whose
+// operands the loop does not assign. They are formed on the way in,
+// the loop having neither calls to clobber the registers nor labels
+// to be entered by. The text of the loop is read ahead for the
+// identifiers it may assign (assigned). A for loop with no calls
+// (plain) stepping up to a constant may count in a register instead
+// of its control variable (var): from the start minus limit + 1 up to
+// zero by VLM, the variable being limit + reg. The indexes by it are
+// modified through the register; it steps in the frame as well only
+// if something else reads it there (read).
+struct LoopHoist {
+    bool open;                  // may keep addresses
+    bool plain;                 // calls no routines
+    int64_t entry;              // the jump to the loads
+    std::vector<int64_t> assigned;
+    std::vector<std::pair<ExprPtr, int64_t>> addrs; // kept out of the heap, register
+    Bitset regs;
+    IdentRecPtr var;
+    int64_t reg, limit;
+    bool read;
+};
+thread_local std::vector<LoopHoist> loopHoists;
+thread_local bool hoistLoops;
 
-IdentRecPtr outputFile,
+thread_local IdentRecPtr outputFile,
     inputFile,
     programObj,
     hashTravPtr,
     uProcPtr;
 
-ExtFileRec * externFileList;
+thread_local ExtFileRec * externFileList;
 
-TypesPtr typ120z, typ121z;
+thread_local TypesPtr typ120z, typ121z;
 
-PtrT * pointerType;
-SetT * setType;
-ScalarT * BooleanType;
-FileT * textType;
-ScalarT * IntegerType;
-RealT * RealType;
-ScalarT * CharType;
-ArrayT * AlfaType;
+thread_local PtrT * pointerType;
+thread_local SetT * setType;
+thread_local ScalarT * BooleanType;
+thread_local FileT * textType;
+thread_local ScalarT * IntegerType;
+thread_local RealT * RealType;
+thread_local ScalarT * CharType;
+thread_local ArrayT * AlfaType;
 
-TypesPtr arg1Type, arg2Type;
+thread_local TypesPtr arg1Type, arg2Type;
 
-NumLabel *  numLabList;
-TypeChain * chain;
-Word curToken, curVal;
+thread_local NumLabel *  numLabList;
+thread_local TypeChain * chain;
+thread_local Word curToken, curVal;
 const int64_t extSymMask = 043000000L;
 const int64_t halfWord = 077777777L;
 const int64_t leftAddr = 077777L << 24;
 
-int64_t leftInsn;
-int64_t curIdent;
-Bitset toAlloc, regsUsed, set146z, set147z, set148z;
-Word optSflags;
-int64_t litOct, litExternal, litForward, litFortran;
-ExprPtr uVarPtr, curExpr;
-InsnList *  insnList;
-ExtFileRec * fileForOutput, * fileForInput;
-int64_t maxSmallString, extSymAdornment;
-
-TypesPtr smallStringType[7]; // [2..6]
-int64_t symTabCnt;
-
-int64_t symTabArray[SYMTAB_MAX+1]; // array [1..80] of Word;
-int64_t symTabIndex[SYMTAB_MAX+1]; // array [1..80] of Integer;
-Operator iMulOpMap[48]; // array [MUL..IMODOP] of Operator;
-Operator setOpMap[48]; // array [MUL..MINUSOP] of Operator;
-Operator iAddOpMap[48]; // array [PLUSOP..MINUSOP] of Operator;
-Entries entryPtTable;
-four frameRestore[7]; // array [3..6] of four;
-int64_t indexreg[16]; // array [1..15] of Integer;
-int64_t opToInsn[48]; // array [MUL..op44] of Integer;
-int64_t opToMode[48]; // array [MUL..op44] of Integer;
-OpFlg opFlags[48]; // array [MUL..op44] of OpFlg;
-int64_t funcInsn[24]; // array [0..23] of Integer;
-int64_t InsnTemp[48]; // array [Insn] of Integer;
+thread_local int64_t leftInsn;
+thread_local int64_t curIdent;
+thread_local Bitset toAlloc, regsUsed, set146z, set147z, set148z;
+thread_local Word optSflags;
+thread_local int64_t litOct, litExternal, litForward, litFortran;
+thread_local ExprPtr uVarPtr, curExpr;
+thread_local InsnList *  insnList;
+thread_local ExtFileRec * fileForOutput, * fileForInput;
+thread_local int64_t maxSmallString, extSymAdornment;
+
+thread_local TypesPtr smallStringType[7]; // [2..6]
+
+// An open addressing hash table from words to the non-negative numbers
+// (positions in FCST or in the symbol table) given to them; it doubles
+// when half full, the size being a power of two.
+struct WordMap {
+    struct Slot {
+        int64_t key;
+        int64_t val;        // -1 if the slot is free
+    };
+    std::vector<Slot> tab;
+    size_t cnt;
+    WordMap() : cnt(0) { }
+    size_t hash(int64_t key) const {
+        return (uint64_t(key) * 0x9E3779B97F4A7C15ULL) >> 32;
+    }
+    Slot & slot(int64_t key) {
+        size_t h = hash(key);
+        while (tab[h & (tab.size() - 1)].val >= 0 &&
+               tab[h & (tab.size() - 1)].key != key)
+            ++h;
+        return tab[h & (tab.size() - 1)];
+    }
+    // The number given to key, or -1.
+    int64_t find(int64_t key) {
+        return cnt ? slot(key).val : -1;
+    }
+    void insert(int64_t key, int64_t val) {
+        if (2 * (cnt + 1) > tab.size()) {
+            std::vector<Slot> old(tab.size() ? 2 * tab.size() : 256, Slot{0, -1});
+            old.swap(tab);
+            for (size_t i = 0; i < old.size(); ++i)
+                if (old[i].val >= 0)
+                    slot(old[i].key) = old[i];
+        }
+        Slot & s = slot(key);
+        cnt += s.val < 0;
+        s.key = key;
+        s.val = val;
+    }
+    void clear() {
+        tab.clear();
+        cnt = 0;
+    }
+};
+
+thread_local WordMap symTabMap; // symbol table entries by contents
+thread_local WordMap upLevelVars; // variables used by other routines than their own
+thread_local Operator iMulOpMap[48]; // array [MUL..IMODOP] of Operator;
+thread_local Operator setOpMap[48]; // array [MUL..MINUSOP] of Operator;
+thread_local Operator iAddOpMap[48]; // array [PLUSOP..MINUSOP] of Operator;
+thread_local Entries entryPtTable;
+thread_local four frameRestore[7]; // array [3..6] of four;
+thread_local int64_t indexreg[16]; // array [1..15] of Integer;
+thread_local int64_t opToInsn[48]; // array [MUL..op44] of Integer;
+thread_local int64_t opToMode[48]; // array [MUL..op44] of Integer;
+thread_local OpFlg opFlags[48]; // array [MUL..op44] of OpFlg;
+thread_local int64_t funcInsn[24]; // array [0..23] of Integer;
+thread_local int64_t InsnTemp[48]; // array [Insn] of Integer;
 
 int64_t frameRegTemplate = 04000000,
         constRegTemplate = I8,
         disNormTemplate = KNTR+7;
 
-char lineBufBase[132]; // array [1..130] of char;
-int64_t errMapBase[10]; // array [0..9] of Integer;
-Operator chrClassTabBase[256]; // array ['_000'..'_177'] of Operator;
-KeyWord * KeyWordHashTabBase[128]; // array [0..127] of @KeyWord;
-Symbol charSymTabBase[256]; // array ['_000'..'_177'] of Symbol;
-IdentRecPtr symHashTabBase[128]; // array [0..127] of IdentRecPtr;
-IdentRecPtr typeHashTabBase[128]; //array [0..127] of IdentRecPtr;
-int64_t helperMap[100]; // array [1..99] of Integer;
+thread_local char lineBufBase[132]; // array [1..130] of char;
+thread_local int64_t errMapBase[10]; // array [0..9] of Integer;
+thread_local Operator chrClassTabBase[256]; // array ['_000'..'_177'] of Operator;
+thread_local Symbol charSymTabBase[256]; // array ['_000'..'_177'] of Symbol;
+thread_local IdentRecPtr symHashTabBase[HASH_SIZE]; // array [0..127] of IdentRecPtr;
+thread_local IdentRecPtr typeHashTabBase[HASH_SIZE]; //array [0..127] of IdentRecPtr;
+// The identifier table entries the identifiers were added to, in order;
+// exitScope() trims those added to since the start of the scope.
+thread_local std::vector<IdentRecPtr *> scopeLog;
+thread_local int64_t helperMap[100]; // array [1..99] of Integer;
 extern int64_t helperNames[100]; // array [1..99] of Bitset;
 
-int64_t symTab[SYMTAB_LIMIT + 1]; // array [74000B..75500B] of Bitset;
+thread_local int64_t symTab[SYMTAB_LIMIT + 1]; // array [74000B..75500B] of Bitset;
 extern int64_t systemProcNames[30]; // array [0..29] of Integer;
-extern int64_t resWordNameBase[30]; // array [0..29] of Integer;
-int64_t longSymCnt;
-int64_t longSymTabBase[91]; // array [1..90] of Integer;
-int64_t longSyms[91]; // array [1..90] of Bitset;
-Word constVals[MAXLIT+1]; // array [1..500] of Alfa;
-int64_t constNums[MAXLIT+1]; // array [1..500] of Integer;
-int64_t objBuffer[OBJBUF_SIZE+1]; // array [1..1024] of Bitset;
-char koi2text[256];
-std::vector<int64_t> FCST; // file of Bitset; /* last */
-
-std::vector<int64_t> CHILD; // file of Bitset;
+// Long external names, in the order of allocation, with their entries
+thread_local std::vector<int64_t> longSymTabBase;
+thread_local std::vector<int64_t> longSyms;
+thread_local WordMap longSymMap; // name => entry
+thread_local WordMap litPool;    // FCST words by value => position
+thread_local int64_t objBuffer[OBJBUF_SIZE+1]; // array [1..1024] of Bitset;
+thread_local char koi2text[256];
+thread_local std::vector<int64_t> FCST; // file of Bitset; /* last */
+
+thread_local std::vector<int64_t> CHILD; // file of Bitset;
 
 struct PasInfor {
     int64_t listMode;
     int64_t startOffset;
-} PASINFOR;
+};
+thread_local PasInfor PASINFOR;
 
 static const char *koi2utf[64] = {
     "ю","а","б","ц","д","е","ф","г","х","и","й","к","л","м","н","о",
@@ -1130,16 +1542,17 @@ struct programme {
     StrLabel * strLabList;
 
     int64_t l2int18z, ii, localSize, l2int21z, jj;
-    static std::vector<programme *> super;
+    int64_t scopeMark;          // in scopeLog
+    static thread_local std::vector<programme *> super;
     programme();
     ~programme() {
         super.pop_back();
     }
 };
 
-std::vector<programme *> programme::super;
+thread_local std::vector<programme *> programme::super;
 
-const char *progname;
+thread_local const char *progname;
 
 const char * pasmitxt(int64_t errNo)
 {
@@ -1206,24 +1619,24 @@ const char * pasmitxt(int64_t errNo)
 
 void printErrMsg(int64_t errNo)
 {
-    putchar(' ');
+    putc(' ', listing);
     if (errNo >= 200)
-        printf("Internal error %ld", errNo);
+        fprintf(listing, "Internal error %ld", errNo);
     else {
         if (errNo > 88)
             printErrMsg(86);
         else if (errNo == 20)
             errNo = (SY == IDENT)*2 + 1;
         else if (16 <= errNo && errNo <= 18)
-            printf("%ld ", int64_t(curToken.i));
-        printf("%s ", pasmitxt(errNo));
+            fprintf(listing, "%ld ", int64_t(curToken.i));
+        fprintf(listing, "%s ", pasmitxt(errNo));
         if (errNo == 17)
-            printf("%ld", int97z);
+            fprintf(listing, "%ld", int97z);
         else if (errNo == 22)
-            printf("%6s", stmtName.c_str());
+            fprintf(listing, "%6s", stmtName.c_str());
     }
     if (errNo != 86 && errNo != 78 && errNo != 79)
-        putchar('\n');
+        putc('\n', listing);
 }
 
 void printTextWord(int64_t val)
@@ -1231,7 +1644,7 @@ void printTextWord(int64_t val)
     const char *s = toAscii(val).c_str();
     while (*s == ' ')
         s++;
-    fputs(s, stdout);
+    fputs(s, listing);
 }
 
 std::string Word::pt() const
@@ -1277,11 +1690,24 @@ TypesPtr makeStringType()
     }
 }
 
+// The bucket of an identifier: the TEXT-coded name multiplied by
+// the golden ratio, the top bits of the product taken.
+inline int identBucket(int64_t id)
+{
+    return ((uint64_t(id) & 0xFFFFFFFFFFFFULL) * 0x9E3779B97F4A7C15ULL) >> (64 - HASH_BITS);
+}
+
+// Links the entry at the head of a chain of an identifier table.
+void linkIdent(IdentRecPtr & head, IdentRecPtr arg)
+{
+    arg->next = head;
+    head = arg;
+    scopeLog.push_back(&head);
+}
+
 void addToHashTab(IdentRecPtr arg)
 {
-    int bucket = (arg->id % 65535) % 128;
-    arg->next = symHashTabBase[bucket];
-    symHashTabBase[bucket] = arg;
+    linkIdent(symHashTabBase[identBucket(arg->id)], arg);
 }
 
 void error(int64_t errNo);
@@ -1290,6 +1716,8 @@ void storeObjWord(int64_t insn)
 {
     objBuffer[objBufIdx] = insn;
     moduleOffset = moduleOffset + 1;
+    if (objBufIdx > stats.objBufPeak)
+        stats.objBufPeak = objBufIdx;
     if (objBufIdx == OBJBUF_SIZE) {
         error(49); /* errTooManyInsnsInBlock */
         objBufIdx = 1;
@@ -1397,7 +1825,9 @@ void formAndAlign(int64_t arg)
 void putToSymTab(int64_t arg)
 {
     symTab[symTabPos] = arg;
-    fprintf(stderr, "SYMTAB idx %05o = %016llo %s\n", symTabPos, arg, toAscii(arg).c_str());
+    if (verbose > 1)
+        fprintf(stderr, "SYMTAB idx %05o = %016llo %s\n", symTabPos, arg, toAscii(arg).c_str());
+    ++stats.symbols;
     if (symTabPos == SYMTAB_LIMIT) {
         error(50); /* errSymbolTableOverflow */
         symTabPos = 074000;
@@ -1413,19 +1843,12 @@ int64_t allocExtSymbol(int64_t newSym)
     int64_t ret = symTabPos;
 
     if (curVal.ii & halfWord) {
-        int64_t i;
-        for (i = 1; i <= longSymCnt; ++i) {
-            if (curVal.ii == longSyms[i]) {
-                return longSymTabBase[i];
-            }
-        }
-        longSymCnt++;
-        if (longSymCnt >= 90) {
-            error(51); /* errLongSymbolOverflow */
-            longSymCnt = 1;
-        };
-        longSymTabBase[longSymCnt] = symTabPos;
-        longSyms[longSymCnt] = curVal.ii;
+        int64_t pos = longSymMap.find(curVal.ii);
+        if (pos >= 0)
+            return pos;
+        longSymMap.insert(curVal.ii, symTabPos);
+        longSymTabBase.push_back(symTabPos);
+        longSyms.push_back(curVal.ii);
         newSym |= 020000000;
     } else {
         newSym |= curVal.ii;
@@ -1449,49 +1872,17 @@ void toFCST()
     FcstCnt = FcstCnt + 1;
 }
 
+// Returns the position of curVal in FCST, emitting it if it is new.
+// The original kept the literals sorted by the BESM-6 comparison,
+// which is not transitive, and stopped at 500 of them, so some were
+// emitted repeatedly; here all of them are shared.
 int64_t addCurValToFCST()
 {
-    int64_t ret;
-    int64_t low, high, mid;
-    low = 1;
-    static std::set<int64_t> lits;
-    if (FcstTotal == 0) {
-        ret = FcstCnt;
-        FcstTotal = 1;
-        constVals[1] = curVal;
-        constNums[1] = FcstCnt;
-        toFCST();
-        lits.insert(curVal.i);
-    } else {
-        high = FcstTotal;
-        do {
-            mid = (low + high) / 2;
-            if (curVal.m == constVals[mid].m) {
-              return constNums[mid];
-            }
-            if (curVal.a < constVals[mid].a)
-                high = mid - 1;
-            else
-                low = mid + 1;
-        } while (low <= high);
+    int64_t ret = litPool.find(curVal.m.val);
+    if (ret < 0) {
         ret = FcstCnt;
-        if (FcstTotal != MAXLIT) {
-            if (curVal.a < constVals[mid].a)
-                high = mid;
-            else
-                high = mid + 1;
-            for (mid = FcstTotal; mid >= high; --mid) {
-                low = mid + 1;
-                constVals[low] = constVals[mid];
-                constNums[low] = constNums[mid];
-            }
-            FcstTotal = FcstTotal + 1;
-            constVals[high] = curVal;
-            constNums[high] = FcstCnt;
-            lits.insert(curVal.i);
-            if (lits.size() != FcstTotal)
-                fprintf(stderr, "Literal divergence: %d\n", int(FcstTotal - lits.size()));
-        };
+        litPool.insert(curVal.m.val, ret);
+        FcstTotal = FcstTotal + 1;
         toFCST();
     }
     return ret;
@@ -1499,45 +1890,12 @@ int64_t addCurValToFCST()
 
 int64_t allocSymtab(int64_t newSym)
 {
-    int64_t ret = symTabPos;
-
-    if (symTabCnt == 0) {
-        symTabCnt = 1;
-        symTabArray[1] = newSym;
-        symTabIndex[1] = symTabPos;
-    } else {
-        int64_t low = 1;
-        int64_t high = symTabCnt;
-        int64_t mid;
-
-        do {
-            mid = (low + high) / 2;
-            if (newSym == symTabArray[mid]) {
-                return symTabIndex[mid];
-            }
-            if (newSym < symTabArray[mid])
-                high = mid - 1;
-            else
-                low = mid + 1;
-        } while (high >= low);
+    int64_t ret = symTabMap.find(newSym);
 
-        if (symTabCnt >= SYMTAB_MAX) {
-            error(50); /* errSymbolTableOverflow */
-        } else {
-            if (newSym < symTabArray[mid])
-                high = mid;
-            else
-                high = mid + 1;
-            for (mid = symTabCnt; mid >= high; --mid) {
-                low = mid + 1;
-                symTabArray[low] = symTabArray[mid];
-                symTabIndex[low] = symTabIndex[mid];
-            }
-            symTabCnt = symTabCnt + 1;
-            symTabArray[high] = newSym;
-            symTabIndex[high] = symTabPos;
-        }
-    }
+    if (ret >= 0)
+        return ret;
+    ret = symTabPos;
+    symTabMap.insert(newSym, ret);
     putToSymTab(newSym);
     return ret;
 }
@@ -1710,18 +2068,18 @@ L1:     addr = curVal.ii & 077777;
 void prInsn(int insn)
 {
     if ((insn >> 19) & 1)
-        printf("%02o %02o %05o", insn >> 20, (insn >> 15) & 037, insn & 077777);
+        fprintf(listing, "%02o %02o %05o", insn >> 20, (insn >> 15) & 037, insn & 077777);
     else
-        printf("%02o %03o %04o", insn >> 20, (insn >> 12) & 0177, insn & 07777);
+        fprintf(listing, "%02o %03o %04o", insn >> 20, (insn >> 12) & 0177, insn & 07777);
 }
 
 void OBPROG(int64_t & start, int64_t & fin)
 {
     for (int64_t * p = &start; p <= &fin; ++p) {
-        if (p != &start && (p - &start) % 4 == 0) putchar('\n');
-        prInsn(*p >> 24); putchar(' '); prInsn(*p & 0xFFFFFF); printf("     ");
+        if (p != &start && (p - &start) % 4 == 0) putc('\n', listing);
+        prInsn(*p >> 24); putc(' ', listing); prInsn(*p & 0xFFFFFF); fprintf(listing, "     ");
     }
-    putchar('\n');
+    putc('\n', listing);
 }
 
 //
@@ -1730,7 +2088,7 @@ void OBPROG(int64_t & start, int64_t & fin)
 static void kputc(uint8_t c)
 {
     if (c >= 0300) {
-        fputs(koi2utf[c - 0300], stdout);
+        fputs(koi2utf[c - 0300], listing);
         return;
     }
     if (c < 040) {
@@ -1740,11 +2098,11 @@ static void kputc(uint8_t c)
         };
         const char *u = extra2utf[c];
         if (u) {
-            fputs(u, stdout);
+            fputs(u, listing);
             return;
         }
     }
-    putchar(c);
+    putc(c, listing);
 }
 
 void endOfLine()
@@ -1754,15 +2112,15 @@ void endOfLine()
 
     listMode = PASINFOR.listMode;
     if ((listMode != 0) or (errsInLine != 0)) {
-        printf(" %05lo%5ld%3ld%c", (lineStartOffset + PASINFOR.startOffset),
+        fprintf(listing, " %05lo%5ld%3ld%c", (lineStartOffset + PASINFOR.startOffset),
                lineCnt, lineNesting, commentModeCH);
         startPos = 12;
         if (optSflags.m.has(S4)
             and (maxLineLen == 72)
             and (linePos >= 80)) {
             for (err = 73; err <= 80; ++err)
-                putchar(lineBufBase[err]);
-            putchar(' ');
+                putc(lineBufBase[err], listing);
+            putc(' ', listing);
             linePos = 73;
             startPos += 9;
         }; /* 1106 */
@@ -1772,20 +2130,20 @@ void endOfLine()
         for (err = 1; err <= linePos; ++err) {
             kputc(lineBufBase[err]);
         };
-        putchar('\n');
+        putc('\n', listing);
         if (errsInLine != 0)  {
-            printf("%*s %*c0", int(startPos), "^^^^^", int(errMapBase[0]), ' ');
+            fprintf(listing, "%*s %*c0", int(startPos), "^^^^^", int(errMapBase[0]), ' ');
             lastErr = errsInLine - 1;
             for (err = 1; err <= lastErr; ++err) {
                 errPos = errMapBase[err];
                 prevPos = errMapBase[err-1];
                 if (errPos != prevPos) {
                     if (prevPos + 1 != errPos)
-                        printf("%*c", int(errPos-prevPos-1), ' ');
-                    putchar(char(err + 48));
+                        fprintf(listing, "%*c", int(errPos-prevPos-1), ' ');
+                    putc(char(err + 48), listing);
                 }
             }
-            putchar('\n');
+            putc('\n', listing);
             errsInLine = 0;
             prevErrPos = 0;
         }
@@ -1794,12 +2152,25 @@ void endOfLine()
         OBPROG(objBuffer[objBufIdx - moduleOffset + lineStartOffset],
                objBuffer[objBufIdx-1]);
     } /* 1174 */
+    if (listMode == 2) {
+        for (size_t i = 0; i < inlinedHere.size(); ++i) {
+            if (i == 0 or inlinedHere[i].second != inlinedHere[i-1].second) {
+                if (i != 0)
+                    putc('\n', listing);
+                fprintf(listing, "      inline at line %ld:", inlinedHere[i].second);
+            }
+            putc(' ', listing);
+            printTextWord(inlinedHere[i].first->id);
+        }
+        if (not inlinedHere.empty())
+            putc('\n', listing);
+    }
+    inlinedHere.clear();
     lineStartOffset = moduleOffset;
     linePos = 0;
     lineCnt = lineCnt + 1;
     // One EOF is OK when the file doesn't have any extra characters after "END."
-    static int eofs;
-    if (feof(pasinput) && eofs++) {
+    if (srcEOF && eofCnt++) {
         error(errEOFEncountered);
         throw 9999;
     }
@@ -1811,56 +2182,85 @@ void requiredSymErr(Symbol sym)
         error(sym + 88);
 } /* requiredSymErr */
 
-static unsigned char
-unicode_to_koi8(int val)
-{
-    static std::map<int, unsigned char> uni2koi8;
-    if (uni2koi8.empty()) {
-        static wchar_t cyr[] = L"юабцдефгхийклмнопярстужвьызшэщчъ"
-                               L"ЮАБЦДЕФГХИЙКЛМНОПЯРСТУЖВЬЫЗШЭЩЧЪ";
+// The source is read at once and transcoded to KOI-8 in srcText;
+// the lexer takes the characters from there. The code points are
+// translated by a flat table covering all the characters of interest.
+const int UNI_LIMIT = 0x2270;
+static const struct Uni2koi8 {
+    unsigned char tab[UNI_LIMIT];
+    Uni2koi8() {
+        static const wchar_t cyr[] = L"юабцдефгхийклмнопярстужвьызшэщчъ"
+                                     L"ЮАБЦДЕФГХИЙКЛМНОПЯРСТУЖВЬЫЗШЭЩЧЪ";
+        for (int i = 0; i < UNI_LIMIT; ++i)
+            tab[i] = i < 0177 ? i : ' ';
         for (int i = 0; cyr[i]; ++i)
-            uni2koi8[cyr[i]] = (unsigned char)(i + 0300);
-        uni2koi8[L'×'] = 6;
-        uni2koi8[L'#'] = uni2koi8[L'≠'] = 030;
-        uni2koi8[L'≤'] = 016;
-        uni2koi8[L'≥'] = 017;
-        uni2koi8[L'≡'] = 027;
-        uni2koi8[L'÷'] = 032;
-        uni2koi8[L'∨'] = 036;
-        uni2koi8[L'~'] = 037;
+            tab[cyr[i]] = (unsigned char)(i + 0300);
+        tab[L'×'] = 6;
+        tab[L'#'] = tab[L'≠'] = 030;
+        tab[L'≤'] = 016;
+        tab[L'≥'] = 017;
+        tab[L'≡'] = 027;
+        tab[L'÷'] = 032;
+        tab[L'∨'] = 036;
+        tab[L'~'] = 037;
+    }
+    unsigned char operator[](int i) const { return tab[i]; }
+} uni2koi8;
+
+void readSource()
+{
+    std::string bytes;
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), pasinput)) > 0)
+        bytes.append(buf, n);
+    if (pasinput != stdin)
+        fclose(pasinput);
+    srcText.clear();
+    srcText.reserve(bytes.size());
+    const unsigned char * p = reinterpret_cast<const unsigned char *>(bytes.data());
+    const unsigned char * end = p + bytes.size();
+    while (p < end) {
+        // Runs of the ASCII characters standing for themselves are copied
+        const unsigned char * run = p;
+        while (p < end && *p < 0200 && uni2koi8[*p] == *p)
+            ++p;
+        srcText.append(run, p);
+        if (p == end)
+            break;
+        int c1 = *p++, c2, c3, val;
+        if (!(c1 & 0x80)) {
+            srcText += uni2koi8[c1];
+            continue;
+        }
+        // Truncated sequences get the bits of EOF, as with getc()
+        c2 = p < end ? *p++ : -1;
+        if (! (c1 & 0x20))
+            val = (c1 & 0x1f) << 6 | (c2 & 0x3f);
+        else {
+            c3 = p < end ? *p++ : -1;
+            val = (c1 & 0x0f) << 12 | (c2 & 0x3f) << 6 | (c3 & 0x3f);
+        }
+        srcText += val < UNI_LIMIT ? uni2koi8[val] : ' ';
     }
-    if (uni2koi8.count(val))
-        return uni2koi8[val];
-    else if (val < 0177)
-        return (unsigned char)val;
-    else return ' ';
-}
-
-static int utf8_getc(FILE *fin)
-{
-    int c1, c2, c3;
-    c1 = getc (fin);
-    if (c1 < 0 || ! (c1 & 0x80))
-        return c1;
-    c2 = getc (fin);
-    if (! (c1 & 0x20))
-        return (c1 & 0x1f) << 6 | (c2 & 0x3f);
-    c3 = getc (fin);
-    return (c1 & 0x0f) << 12 | (c2 & 0x3f) << 6 | (c3 & 0x3f);
-
+    srcPos = 0;
+    srcEOF = false;
 }
 
-static unsigned char ugetc(FILE * fin)
+static inline unsigned char ugetc()
 {
-    return unicode_to_koi8(utf8_getc(fin));
+    if (srcPos < srcText.size())
+        return srcText[srcPos++];
+    srcEOF = true;
+    return 0377;
 }
 
 void readToPos80()
 {
-    while (!feof(pasinput) && linePos < 81 && PASINPUT != '\n') {
+    while (!srcEOF && linePos < 81 && PASINPUT != '\n') {
         linePos = linePos + 1;
         lineBufBase[linePos] = PASINPUT;
-        if (linePos != 81) PASINPUT = ugetc(pasinput);
+        if (linePos != 81) PASINPUT = ugetc();
     }
     endOfLine();
 }
@@ -1870,7 +2270,7 @@ struct inSymbol {
     int64_t tokenLen, tokenIdx;
     bool expSign;
     IdentRecPtr l3var135z;
-    Real expMultiple, expValue;
+    Real expMultiple, expValue, digit;
     char curChar;
     int64_t numstr[17];
     int64_t expLiteral;
@@ -1884,22 +2284,104 @@ struct inSymbol {
 void nextCH()
 {
     do {
-        atEOL = PASINPUT == '\n' || feof(pasinput);
+        atEOL = PASINPUT == '\n' || srcEOF;
         CH = PASINPUT;
-        PASINPUT = ugetc(pasinput);
+        PASINPUT = ugetc();
         linePos = linePos + 1;
         lineBufBase[linePos] = CH;
     } while (not ((maxLineLen >= linePos) or atEOL));
 } /* nextCH */
 
+// The lexical rules below are shared by the lexer and by scanLoop,
+// reading the source ahead of it; each reads through a reader giving
+// the current character (ch), whether it ends the line (eol) or the
+// text (atEnd), and stepping to the next one (next).
+
+// The lexer's: CH, read by nextCH(), listing the lines it passes
+struct SourceReader {
+    unsigned char ch() const { return CH; }
+    bool eol() const { return atEOL; }
+    bool atEnd() const { return false; }   // endOfLine() stops there
+    void next() {
+        if (atEOL)
+            endOfLine();
+        nextCH();
+    }
+};
+
+// The text from pos on, as the lexer would see it: the columns past
+// maxLineLen are skipped; col is the column of ch().
+struct TextReader {
+    size_t pos;
+    int64_t col;
+    unsigned char at(size_t k) const {
+        return pos + k < srcText.size() ? srcText[pos + k] : ' ';
+    }
+    unsigned char ch() const { return at(0); }
+    bool eol() const { return atEnd() or srcText[pos] == '\n'; }
+    bool atEnd() const { return pos >= srcText.size(); }
+    void next() {
+        do {
+            if (atEnd())
+                return;
+            col = srcText[pos] == '\n' ? 1 : col + 1;
+            ++pos;
+        } while (col > maxLineLen and not eol());
+    }
+};
+
+// Steps over the end of a line; a line starting with % is skipped.
+template<class Reader> void nextLine(Reader & r)
+{
+    r.next();
+    if (r.ch() == '%')
+        while (not r.eol())
+            r.next();
+}
+
+// Skips a comment from its first character up to after its end;
+// either '}' or '*)' ends it, whichever way it was opened.
+template<class Reader> void skipComment(Reader & r)
+{
+    bool brace;
+    do {
+        while (r.ch() != '*' and r.ch() != '}' and not r.atEnd())
+            r.next();
+        brace = (r.ch() == '}');
+        r.next();
+    } while (not brace and r.ch() != ')' and not r.atEnd());
+    if (not brace)
+        r.next();
+}
+
+// Reads a string from its opening quote up to after the closing one,
+// a doubled quote standing for the quote. Each character is at r.ch()
+// when put is called for it; put may read on from there, and returns
+// false when no more fit. Returns false if the string is not closed
+// on its line or did not fit.
+template<class Reader, class Put> bool scanString(Reader & r, Put put)
+{
+    for (;;) {
+        r.next();
+        if (charSymTabBase[r.ch()] == CHARCONST) {
+            r.next();
+            if (charSymTabBase[r.ch()] != CHARCONST)
+                return true;
+        } else if (r.eol())
+            return false;
+        if (not put())
+            return false;
+    }
+}
+
 struct parseComment {
     // non-recursive, no need for a super stack
-    static parseComment * super;
+    static thread_local parseComment * super;
     bool badOpt, flag;
     char c;
     parseComment();
 };
-parseComment * parseComment::super;
+thread_local parseComment * parseComment::super;
 
 int64_t readOptVal(int64_t limit)
 {
@@ -1990,26 +2472,31 @@ parseComment::parseComment()
             case 'Z': case 'z':
                 readOptFlag(pseudoZ);
                 break;
+            case 'N': case 'n':
+                caseMode = readOptVal(3);
+                break;
+            case 'I': case 'i':
+                inlineLimit = readOptVal(63);
+                break;
+            case 'O': case 'o':
+                readOptFlag(hoistLoops);
+                break;
+            case 'X': case 'x':
+                readOptFlag(reduceOps);
+                break;
+            case 'G': case 'g':
+                readOptFlag(threadCode);
+                break;
             }
             if (badOpt)
                 error(54); /* errErrorInPseudoComment */
         } while (CH == ',');
     }; /* 1446 */
-    bool brace;
-    do {
-        while (CH != '*' && CH != '}') {
-            c = commentModeCH;
-            commentModeCH = '*';
-            if (atEOL)
-                endOfLine();
-            nextCH();
-            commentModeCH = c;
-        };
-        brace = (CH == '}');
-        nextCH();
-    } while (!brace && CH != ')');
-    if (!brace)
-        nextCH();
+    SourceReader source;
+    c = commentModeCH;
+    commentModeCH = '*';
+    skipComment(source);
+    commentModeCH = c;
 } /* parseComment */
 
 unsigned char koi8_to_koi7(unsigned char ch)
@@ -2025,6 +2512,9 @@ unsigned char koi8_to_koi7(unsigned char ch)
 
 inSymbol::inSymbol()
 {
+    PhaseTimer timer(stats.lexing);
+    SourceReader source;
+    ++stats.tokens;
 again: {
         if (dataCheck) {
             error(errEOFEncountered);
@@ -2047,9 +2537,7 @@ L1473:
         }
         */
         if (atEOL) {
-            endOfLine();
-            nextCH();
-            if (CH == '%') while (not atEOL) nextCH();
+            nextLine(source);
             goto L1473;
         }
         hashTravPtr = NULL;
@@ -2070,16 +2558,15 @@ L1:             curToken.m.val = 0;
                         curToken.m = curToken.m + curVal.m;
                     }
                 } while (chrClassTabBase[CH] == ALNUM);
-                bucket = curToken.m.val % 65535 % 128;
+                bucket = identBucket(curToken.ii);
                 curIdent = curToken.ii;
-                keyWordHashPtr = KeyWordHashTabBase[bucket];
-                while (keyWordHashPtr != NULL) {
-                    if (keyWordHashPtr->w.m == curToken.m) {
-                        SY = keyWordHashPtr->sym;
-                        charClass = keyWordHashPtr->op;
+                {
+                    const KeyWord & kw = keyWordTab.slot[kwSlot(curToken.m.val, KW_MULT)];
+                    if (kw.w == int64_t(curToken.m.val)) {
+                        SY = kw.sym;
+                        charClass = kw.op;
                         goto exitLexer;
                     }
-                    keyWordHashPtr = keyWordHashPtr->next;
                 }
                 isDefined = false;
                 SY = IDENT;
@@ -2222,12 +2709,16 @@ L2:                 hashTravPtr = symHashTabBase[bucket];
                     }
                     curToken.r = curToken.i;
                     SY = REALCONST;
+                    // Computed as the compiler did it on the BESM-6
+                    expMultiple = int64_t(10);
                     if (charSymTabBase[CH] != INTCONST)
                         error(56); /* errNeedMantissaAfterDecimal */
                     else
                         do {
                             if (expMagnitude > -18) {
-                                curToken.r = 10.0*curToken.r + CH - 48;
+                                digit = int64_t(CH - 48);
+                                besm6Mul(curToken.r, curToken.r, expMultiple);
+                                besm6Add(curToken.r, curToken.r, digit, false);
                                 expMagnitude = expMagnitude-1;
                             }
                             nextCH();
@@ -2260,45 +2751,33 @@ L2:                 hashTravPtr = symHashTabBase[bucket];
                         expMagnitude = expMagnitude + expLiteral;
                 }; /* 2122 */
                 if (expMagnitude != 0) {
-                    expValue = 1.0;
+                    expValue = int64_t(1);
                     expSign = expMagnitude < 0;
                     expMagnitude = std::abs(expMagnitude);
-                    expMultiple = 10.0;
+                    expMultiple = int64_t(10);
                     if (18 < expMagnitude) {
                         expMagnitude = 1;
                         error(58); /* errExponentGreaterThan18 */
                     }
                     do {
                         if (expMagnitude & 1)
-                            expValue = expValue * expMultiple;
+                            besm6Mul(expValue, expValue, expMultiple);
                         expMagnitude = expMagnitude / 2;
                         if (expMagnitude != 0)
-                            expMultiple = expMultiple*expMultiple;
+                            besm6Mul(expMultiple, expMultiple, expMultiple);
                     } while (expMagnitude != 0);
-                    if (expSign)
-                        curToken.r = curToken.r / expValue;
-                    else
-                        curToken.r = curToken.r * expValue;
+                    if (not (expSign ? besm6Div(curToken.r, curToken.r, expValue)
+                                     : besm6Mul(curToken.r, curToken.r, expValue)))
+                        error(58); /* errExponentGreaterThan18 */
                 }
                 goto exitLexer;
             } break; /* INTCONST */ /*=m+*/
             case CHARCONST: {
-                {
-                    for (tokenIdx = 6; tokenIdx <= 130; ++tokenIdx) {
-                        nextCH();
-                        if (charSymTabBase[CH] == CHARCONST) {
-                            nextCH();
-                            if (charSymTabBase[CH] != CHARCONST)
-                                goto exitLoop;
-                            else
-                                goto L2233;
-                        }
-                        if (atEOL) {
-L2175:                      error(59); /* errEOLNInStringLiteral */
-                            goto exitLoop;
-                        } else if (((CH == '\035') or /* ≡ */
-                                    (charSymTabBase[CH] == REALCONST))
-                                   and (charSymTabBase[PASINPUT] == INTCONST)) {
+                tokenIdx = 6;
+                if (not scanString(source, [&]() -> bool {
+                        if (((CH == '\035') or /* ≡ */
+                             (charSymTabBase[CH] == REALCONST))
+                            and (charSymTabBase[PASINPUT] == INTCONST)) {
                             expLiteral = 0;
                             for (tokenLen = 1; tokenLen <= 3; ++tokenLen) {
                                 nextCH();
@@ -2314,7 +2793,7 @@ L2175:                      error(59); /* errEOLNInStringLiteral */
                         } else {
                             // Modify output encoding:
                             // a0 - UTF-8, a1 - KOI-8, a2 - KOI7 (default).
-L2233:                      switch (charEncoding) {
+                            switch (charEncoding) {
                             case 0:
                                 // KOI-8 to UTF-8.
                                 if (CH < 0300) {
@@ -2336,10 +2815,9 @@ L2233:                      switch (charEncoding) {
                                 break;
                             }
                         }
-                    }
-                    goto L2175;
-                }
-exitLoop:
+                        return ++tokenIdx <= 130;
+                    }))
+                    error(59); /* errEOLNInStringLiteral */
                 strLen = tokenIdx - 6;
                 if (strLen == 0) {
                    error(61); /* errEmptyString */
@@ -2451,6 +2929,10 @@ loop:                   {
         };
         commentModeCH = ' ';
         int93z = int92z;
+        if (SY == IDENT)
+            ++stats.idents;
+        else if (Bits(INTCONST, REALCONST, CHARCONST, LTSY).has(SY))
+            ++stats.literals;
     }
 } /* inSymbol */
 
@@ -2478,10 +2960,10 @@ void error(int64_t errNo)
         errMapBase[errsInLine] = linePos;
         errsInLine = errsInLine + 1;
         prevErrPos = linePos;
-        printf("Error %ld:", errNo);
+        fprintf(listing, "Error %ld:", errNo);
         printErrMsg(errNo);
         if (60 < totalErrors) {
-            putchar('\n');
+            putc('\n', listing);
             endOfLine();
             printErrMsg(53);
             skipToEnd();
@@ -2569,7 +3051,7 @@ void P2672(IdentRecPtr & l3arg1z, IdentRecPtr l3arg2z)
     int64_t l3var2z = 0;
     IdentRecPtr l3var3z, l3var4z;
     if (l3arg1z == NULL) {
-        l3var2z = (l3arg2z->id % 65535) % 128;
+        l3var2z = identBucket(l3arg2z->id);
         l3var1z = true;
         l3arg1z = symHashTabBase[l3var2z];
     } else {
@@ -2635,7 +3117,7 @@ struct typeCheck {
     TypesPtr basetyp1, basetyp2;
     IdentRecPtr enums1, enums2;
     int64_t span1, span2;
-    static std::vector<typeCheck*> super;
+    static thread_local std::vector<typeCheck*> super;
     ~typeCheck() { super.pop_back(); }
 
     void allocWithTypeCheck() {
@@ -2644,7 +3126,7 @@ struct typeCheck {
         ret = typeCheck(basetyp1, basetyp2);
     }
 };
-std::vector<typeCheck*> typeCheck::super;
+thread_local std::vector<typeCheck*> typeCheck::super;
 
 bool checkRecord(IdentRecPtr l4arg1z, IdentRecPtr l4arg2z)
 {
@@ -2802,7 +3284,7 @@ int64_t makeNameWithStars(bool isProc)
 }
 
 struct formOperator {
-    static std::vector<formOperator*> super;
+    static thread_local std::vector<formOperator*> super;
     formOperator(OpGen l3arg1z);
     ~formOperator() { super.pop_back(); }
 
@@ -2816,13 +3298,17 @@ struct formOperator {
     InsnList * saved;
     bool l3bool13z;
 };
-std::vector<formOperator*> formOperator::super;
+thread_local std::vector<formOperator*> formOperator::super;
 
 struct genOneOp {
     int64_t insnBufIdx;
     int64_t l4var2z, l4var3z, l4var4z;
     Word l4var5z;
-    OneInsnPtr l4inl6z, l4inl7z, l4inl8z;
+    OneInsnPtr l4inl7z, l4inl8z;
+    // The jump targets, the latest last. The jumps in insnBuf refer to
+    // them by index, in 15 bits, rather than by the heap offset.
+    std::vector<OneInsnPtr> labels;
+    int64_t labIdx;             // of l4inl7z
     int64_t l4var9z;
     Word insnBuf[201]; // array [1..200] of Word;
     Word curInsn;
@@ -2849,32 +3335,31 @@ struct genOneOp {
     }; /* add2InsnsToBuf */
 
     bool F3413() {
-        bool ret;
-        l4inl7z = l4inl6z;
-        while (l4inl7z != NULL) {
+        for (labIdx = int64_t(labels.size()) - 1; labIdx >= 0; --labIdx) {
+            l4inl7z = labels[labIdx];
             if (l4inl7z->mode == curInsn.i) {
-                ret = true;
                 while (l4inl7z->code == macro) {
-                    l4inl7z = reinterpret_cast<OneInsn*>(ptr(l4inl7z->offset));
+                    labIdx = l4inl7z->offset;
+                    l4inl7z = labels[labIdx];
                 }
-                return ret;
-            } else {
-                l4inl7z = l4inl7z->next;
+                return true;
             }
         }
+        l4inl7z = NULL;
         return false;
     }; /* F3413 */
 
     void addJumpInsn(int64_t opcode) {
         if (not F3413()) {
             l4inl7z = new OneInsn;
-            l4inl7z->next = l4inl6z;
+            l4inl7z->next = NULL;
             l4inl7z->mode = curInsn.i;
             l4inl7z->code = 0;
             l4inl7z->offset = 0;
-            l4inl6z = l4inl7z;
+            labIdx = labels.size();
+            labels.push_back(l4inl7z);
         };
-        addInsnToBuf(macro + opcode + ord(l4inl7z));
+        addInsnToBuf(macro + opcode + labIdx);
     }; /* addJumpInsn */
 
     genOneOp() {
@@ -2886,7 +3371,6 @@ struct genOneOp {
         insnBufIdx = 1;
         if (l4oi212z == NULL)
             return;
-        l4inl6z = NULL;
 
         while (l4oi212z != NULL) {
             tempInsn.i = l4oi212z->code;
@@ -2930,7 +3414,7 @@ struct genOneOp {
                       curInsn.i = tempInsn.i;
 L3556:
                       if (F3413())
-                          addInsnToBuf(2*macro+ord(l4inl7z));
+                          addInsnToBuf(2*macro+labIdx);
                       else
                           error(206);
                 } break;
@@ -2939,11 +3423,12 @@ L3556:
                       curInsn.i = curInsn.i / 4096;
                       l4var213z =  F3413();
                       l4inl8z = l4inl7z;
+                      int64_t lab8 = labIdx;
                       curInsn.i = tempInsn.i;
                       l4var213z = l4var213z && F3413();
                       if (l4var213z) {
                           l4inl7z->code = macro;
-                          l4inl7z->offset = ord(l4inl8z);
+                          l4inl7z->offset = lab8;
                       }
                       else
                           error(207);
@@ -3128,7 +3613,7 @@ L3556:
                 continue;
             }; /* 4230 */
             if (curInsn.i >= 2*macro) {
-                l4inl7z = reinterpret_cast<OneInsn*>(ptr(curInsn.i - (2*macro)));
+                l4inl7z = labels[curInsn.i - (2*macro)];
                 P0715(0, l4inl7z->code);
                 l4inl7z->offset = moduleOffset;
             } else {
@@ -3136,7 +3621,7 @@ L3556:
                 curVal.m = curInsn.m * (Bits(0, 1, 3) + BitRange(28,32));
                 jumpType = curVal.i;
                 curVal.m = (Bits(0, 1, 3) + BitRange(33,47)) * curInsn.m;
-                l4inl7z = reinterpret_cast<OneInsn*>(ptr(curVal.i));
+                l4inl7z = labels[curVal.i];
                 formJump(l4inl7z->code);
                 jumpType = InsnTemp[UJ];
                 continue;
@@ -3145,12 +3630,11 @@ L3556:
         } /* loop */
 
         insnList = NULL;
-        while (l4inl6z != NULL) {
-            if (l4inl6z->offset == 0) {
-                jumpTarget = l4inl6z->code;
+        for (labIdx = int64_t(labels.size()) - 1; labIdx >= 0; --labIdx) {
+            if (labels[labIdx]->offset == 0) {
+                jumpTarget = labels[labIdx]->code;
                 return;
-            } else
-                l4inl6z = l4inl6z->next;
+            }
         }
         set146z = set146z - regsUsed;
     }
@@ -3446,6 +3930,118 @@ void P5117(Operator op)
         l2int21z = localSize;
 }
 
+/* An assignment to the control variable of an enclosing loop
+ * ends the trust in its range.
+ */
+void noteAssigned(ExprPtr e)
+{
+    size_t k;
+    if (e->op != GETVAR)
+        return;
+    for (k = 0; k < loopRanges.size(); ++k)
+        if (loopRanges[k].var == e->id1)
+            ++loopRanges[k].threats;
+    for (k = 0; k < inductionVars.size(); ++k)
+        if (inductionVars[k].var == e->id1) {
+            ++inductionVars[k].threats;
+            inductionVars[k].stale = not inductionVars[k].temps.empty();
+        }
+}
+
+/* The bounds of the values of an integer or scalar expression, if known.
+ * The values of a subrange type are trusted to be in the range, as the
+ * assignments to them are checked. Indices of the loops relied upon
+ * are added to uses.
+ */
+bool valueRange(ExprPtr e, int64_t & lo, int64_t & hi, std::vector<int64_t> & uses)
+{
+    int64_t lo2, hi2, k;
+    const int64_t big = 1L << 20;
+
+    switch (e->op) {
+    case NOOP:
+        return false;
+    case GETENUM:
+        if (e->typ->k != kindScalar)
+            return false;
+        lo = hi = e->d1.i;
+        return true;
+    case GETVAR:
+        for (k = loopRanges.size() - 1; k >= 0; --k) {
+            LoopRange & r = loopRanges[k];
+            if (r.var != e->id1)
+                continue;
+            /* A later loop or label may reach here after an assignment */
+            if (r.threats != 0 or r.depth != condLoopDepth or
+                r.labels != labelsSeen)
+                break;
+            lo = r.lo;
+            hi = r.hi;
+            uses.push_back(k);
+            return true;
+        }
+        break;
+    case INEGOP:
+        if (not valueRange(e->expr1, lo2, hi2, uses))
+            return false;
+        lo = -hi2;
+        hi = -lo2;
+        return true;
+    case INTPLUS: case INTMINUS: case IMULOP:
+        if (not valueRange(e->expr1, lo, hi, uses) or
+            not valueRange(e->expr2, lo2, hi2, uses) or
+            std::max(std::max(-lo, hi), std::max(-lo2, hi2)) >= big)
+            return false;
+        if (e->op == INTPLUS) {
+            lo += lo2;
+            hi += hi2;
+        } else if (e->op == INTMINUS) {
+            lo -= hi2;
+            hi -= lo2;
+        } else {
+            k = lo;
+            lo = std::min(std::min(k * lo2, k * hi2), std::min(hi * lo2, hi * hi2));
+            hi = std::max(std::max(k * lo2, k * hi2), std::max(hi * lo2, hi * hi2));
+        }
+        return true;
+    case IDIVOP:
+        if (not valueRange(e->expr1, lo, hi, uses) or
+            not valueRange(e->expr2, lo2, hi2, uses) or
+            lo2 != hi2 or lo2 <= 0)
+            return false;
+        lo /= lo2;
+        hi /= lo2;
+        return true;
+    case BOUNDS:
+        lo = e->typ2->cast<RangeT>().left;
+        hi = e->typ2->cast<RangeT>().right;
+        return true;
+    default:
+        break;
+    }
+    if (e->typ != NULL and e->typ->k == kindRange) {
+        lo = e->typ->cast<RangeT>().left;
+        hi = e->typ->cast<RangeT>().right;
+        return true;
+    }
+    return false;
+}
+
+/* Whether the range check of e against range may be dropped */
+bool inRange(ExprPtr e, RangeT * range)
+{
+    std::vector<int64_t> uses;
+    int64_t lo, hi;
+    size_t k;
+
+    if (not valueRange(e, lo, hi, uses) or
+        lo < range->left or range->right < hi)
+        return false;
+    for (k = 0; k < uses.size(); ++k)
+        ++loopRanges[uses[k]].uses;
+    return true;
+}
+
 int64_t insnCount()
 {
     int64_t cnt;
@@ -3459,35 +4055,593 @@ int64_t insnCount()
     return cnt;
 }
 
-struct genFullExpr {
-    static std::vector<genFullExpr*> super;
-    genFullExpr(ExprPtr exprToGen_);
-    ~genFullExpr() { super.pop_back(); }
+/* Relative execution times of the short-address instructions,
+ * by opcode; a helper call costs callCost more than its VJM.
+ */
+const int64_t insnCost[040] = {
+/*000*/ 1, 1, 1, 1,  2, 2, 2, 2,   /* ATX STX MOD XTS ADD SUB RSUB AMX */
+/*010*/ 1, 1, 1, 2,  1, 1, 12, 6,  /* XTA AAX AEX ARX AVX AOX A/X A*X */
+/*020*/ 3, 3, 2, 2,  2, 2, 2, 1,   /* APX AUX ACX ANX E+X E-X ASX XTR */
+/*030*/ 1, 1, 1, 1,  1, 1, 1, 1    /* RTE YTA --- --- E+N E-N ASN NTR */
+};
+const int64_t callCost = 12;
 
-    ExprPtr & exprToGen;
-    bool arg1Const, arg2Const;
-    InsnList * otherIns;
-    Word arg1Val, arg2Val;
-    Operator curOP;
-    int64_t work;
+int64_t cost(int64_t insn)
+{
+    return insnCost[(insn >> 12) & 037];
+}
 
-    void P5155() {
-        prepLoad();
-        insnList->ilm = il1;
-        insnList->st = st0;
-        insnList->ilf6 = 0;
-        insnList->ilf5.i = 0;
-        insnList->ilf7 = 18;
-    }; /* P5155 */
+/* Multiplies the loaded operand by c > 1 with additions, if that
+ * is cheaper than the multiplication costing mulCost:
+ * either by adding x to itself, or by doubling the partial product
+ * and adding x for every 1 bit of c, x being kept in SP+1.
+ */
+bool mulByAdds(int64_t c, int64_t mulCost)
+{
+    int64_t top, ones, b, byDoubling, byRepeating;
 
-    void genDeref() {
-        Word l5var1z, l5var2z;
-        bool doPtrCheck;
+    if (not reduceOps or c < 2)
+        return false;
+    top = 0;
+    ones = 0;
+    for (b = c; b > 1; b >>= 1) {
+        ++top;
+        ones += b & 1;
+    }
+    byDoubling = top * (cost(KATX) + cost(KADD)) + ones * cost(KADD);
+    if (ones != 0)
+        byDoubling += cost(KATX);
+    byRepeating = cost(KATX) + (c - 1) * cost(KADD);
+    if (std::min(byDoubling, byRepeating) >= mulCost)
+        return false;
+    prepLoad();
+    if (byRepeating <= byDoubling) {
+        addToInsnList(KATX+SP+1);
+        for (b = c - 1; b != 0; --b) {
+            addToInsnList(KADD+SP+1);
+            insnList->next->mode = 1;
+        }
+        return true;
+    }
+    if (ones != 0)
+        addToInsnList(KATX+SP+1);
+    for (b = top - 1; b >= 0; --b) {
+        addToInsnList(KATX+SP+2);
+        addToInsnList(KADD+SP+2);
+        insnList->next->mode = 1;
+        if ((c >> b) & 1) {
+            addToInsnList(KADD+SP+1);
+            insnList->next->mode = 1;
+        }
+    }
+    return true;
+}
 
-        doPtrCheck = checkBounds and not (optSflags.m.has(NoPtrCheck))
-            and (curOP == DEREF);
-        if (not doPtrCheck and (
-                (insnList->st == st0) or
+/* Computes var * factor into the frame word at offset */
+void storeProduct(IdentRecPtr var, int64_t factor, int64_t offset)
+{
+    ExprPtr l4exp1z, l4exp2z;
+
+    l4exp1z = new Expr;
+    l4exp1z->typ = var->typ;
+    l4exp1z->op = GETVAR;
+    l4exp1z->id1 = var;
+    l4exp2z = new Expr;
+    l4exp2z->typ = IntegerType;
+    l4exp2z->op = GETENUM;
+    l4exp2z->d1.ii = 0;
+    l4exp2z->d1.i = factor;
+    curExpr = new Expr;
+    curExpr->typ = IntegerType;
+    curExpr->op = IMULOP;
+    curExpr->expr1 = l4exp1z;
+    curExpr->expr2 = l4exp2z;
+    (void) formOperator(LOAD);
+    form1Insn(KATX + curFrameRegTemplate + offset);
+}
+
+/* Brings the products of the control variables assigned by
+ * the statement just compiled up to date.
+ */
+void resyncInductionVars()
+{
+    size_t k, t;
+
+    for (k = 0; k < inductionVars.size(); ++k) {
+        InductionVar & iv = inductionVars[k];
+        if (not iv.stale)
+            continue;
+        disableNorm();
+        for (t = 0; t < iv.temps.size(); ++t)
+            storeProduct(iv.var, iv.temps[t].first, iv.temps[t].second);
+        iv.stale = false;
+    }
+}
+
+/* Reads the text of a loop ahead of the parser, from the current
+ * character to the semicolon, END or UNTIL that ends it outside of
+ * the statements it opens (depth of them open already). The first
+ * variables of the assignments and the arguments of the standard
+ * procedures but write and writeln are noted as assigned.
+ * Returns whether the loop indexes or dereferences anything
+ * and calls no routines (plain).
+ */
+bool scanLoop(LoopHoist & loop, int64_t depth)
+{
+    TextReader r = { srcPos - 2, linePos };
+    int64_t parens = 0, args = -1, base = 0, len;
+    bool field = false, procArgs = false, afterProc, indexes = false;
+    unsigned char c;
+    uint64_t word;
+    IdentRecPtr id;
+
+    loop.plain = true;
+    while (not r.atEnd()) {
+        c = r.ch();
+        if (c == '\n') {
+            nextLine(r);
+            continue;
+        }
+        if (charSymTabBase[c] == NOSY) {
+            r.next();
+            continue;
+        }
+        afterProc = procArgs;
+        procArgs = false;
+        if (c == '{' or (c == '(' and r.at(1) == '*')) {
+            r.next();
+            if (c == '(')
+                r.next();
+            skipComment(r);
+            procArgs = afterProc;
+            continue;
+        }
+        switch (charSymTabBase[c]) {
+        case IDENT: {
+            word = 0;
+            len = 0;
+            do {
+                if (len < 8)
+                    word = word << 6 | (koi2text[r.ch()] & 077);
+                ++len;
+                r.next();
+            } while (not r.atEnd() and chrClassTabBase[r.ch()] == ALNUM);
+            const KeyWord & kw = keyWordTab.slot[kwSlot(word, KW_MULT)];
+            if (kw.w == int64_t(word)) {
+                if (kw.sym == BEGINSY or kw.sym == CASESY or
+                    kw.sym == SELECTSY or kw.sym == REPEATSY)
+                    ++depth;
+                else if (kw.sym == ENDSY or kw.sym == UNTILSY) {
+                    if (depth == 0)
+                        return indexes;
+                    --depth;
+                }
+                base = 0;
+                break;
+            }
+            if (args >= 0)
+                loop.assigned.push_back(word);
+            if (parens == 0 and not field)
+                base = word;
+            field = false;
+            for (id = symHashTabBase[identBucket(word)];
+                 id != NULL and id->id != int64_t(word); id = id->next);
+            if (id != NULL and id->cl == ROUTINEID) {
+                if (id->offset != 0 or id->procno() == 16) { /* BESM */
+                    loop.plain = false;
+                    return false;
+                }
+                procArgs = id->typ == NULL and
+                    id->procno() != 10 and id->procno() != 11;
+            }
+        } break;
+        case REALCONST:
+            if (r.at(1) == '(')
+                ++depth;
+            else if (r.at(1) == ')') {
+                if (depth == 0)
+                    return indexes;
+                --depth;
+            } else {
+                r.next();
+                procArgs = afterProc;
+                break;
+            }
+            r.next();
+            r.next();
+            break;
+        case INTCONST:
+            do {
+                r.next();
+                if (r.ch() == '.' and charSymTabBase[r.at(1)] == INTCONST)
+                    r.next();
+            } while (not r.atEnd() and chrClassTabBase[r.ch()] == ALNUM);
+            break;
+        case CHARCONST:
+            (void) scanString(r, [] { return true; });
+            break;
+        case LPAREN:
+            if (r.at(1) == '.') {
+                indexes = true;
+                r.next();
+            } else if (afterProc)
+                args = parens;
+            ++parens;
+            r.next();
+            break;
+        case LBRACK:
+            indexes = true;
+            ++parens;
+            r.next();
+            break;
+        case RPAREN: case RBRACK:
+            --parens;
+            if (parens == args)
+                args = -1;
+            r.next();
+            break;
+        case PERIOD:
+            if (r.at(1) == ')') {
+                --parens;
+                r.next();
+            } else if (r.at(1) == '.')
+                r.next();
+            else
+                field = true;
+            r.next();
+            break;
+        case ARROW:
+            indexes = true;
+            r.next();
+            break;
+        case COLON:
+            if (r.at(1) == '=') {
+                if (base != 0)
+                    loop.assigned.push_back(base);
+                r.next();
+            }
+            base = 0;
+            r.next();
+            break;
+        case SEMICOLON:
+            if (depth == 0)
+                return indexes;
+            base = 0;
+            r.next();
+            break;
+        default:
+            r.next();
+            break;
+        }
+    }
+    return indexes;
+}
+
+/* Starts a loop, which may keep addresses in registers if hoistLoops,
+ * its text allows it and the routine has no labels. A while or repeat
+ * loop (jump) is entered through the loads closeLoop forms after it.
+ */
+void openLoop(int64_t depth, bool jump)
+{
+    LoopHoist loop;
+
+    loop.entry = 0;
+    loop.regs = Bits();
+    loop.plain = loop.read = false;
+    loop.var = NULL;
+    loop.reg = loop.limit = 0;
+    loop.open = hoistLoops and not errors and
+        numLabList == programme::super.back()->l2var16z and
+        scanLoop(loop, depth);
+    if (loop.open and jump)
+        formJump(loop.entry);
+    loopHoists.push_back(loop);
+}
+
+/* The registers holding the addresses and the counts kept by the loops
+ * being compiled
+ */
+Bitset hoistedRegs()
+{
+    Bitset regs = Bits();
+
+    for (auto & loop : loopHoists)
+        regs = regs + loop.regs;
+    return regs;
+}
+
+/* The loop counting the variable of an index in a register, if any */
+LoopHoist * heldIndex(ExprPtr e)
+{
+    if (e->op == GETVAR)
+        for (auto & loop : loopHoists)
+            if (loop.var == e->id1)
+                return &loop;
+    return NULL;
+}
+
+/* Makes an index modify the instruction after it: one held in
+ * a register by a loop is added to the limit with UTC if the elements
+ * take a word each, reading nothing. Returns whether it was.
+ */
+bool modifyByIndex(LoopHoist * held, int64_t size)
+{
+    if (held != NULL and size == 1 and insnList->ilm == il1) {
+        addInsnAndOffset(indexreg[held->reg] + InsnTemp[UTC], held->limit);
+        insnList->ilm = il2;
+        insnList->regsused = insnList->regsused + Bits(0L);
+        return true;
+    }
+    curInsnTemplate = InsnTemp[WTC];
+    prepLoad();
+    curInsnTemplate = InsnTemp[XTA];
+    return false;
+}
+
+void loadHoisted(LoopHoist & loop)
+{
+    for (auto & addr : loop.addrs) {
+        curExpr = addr.first;
+        curVal.i = addr.second;
+        (void) formOperator(ADDRTOREG);
+    }
+}
+
+/* Ends a loop; a while or repeat loop starting at top gets its loads,
+ * a for loop has them formed by forStatement (top 0).
+ */
+void closeLoop(int64_t top)
+{
+    LoopHoist & loop = loopHoists.back();
+    int64_t exit = 0;
+
+    if (top != 0 and loop.entry != 0) {
+        if (loop.addrs.empty())
+            P0715(top, loop.entry);
+        else {
+            formJump(exit);
+            P0715(0, loop.entry);
+            loadHoisted(loop);
+            form1Insn(InsnTemp[UJ] + top);
+            P0715(0, exit);
+        }
+    }
+    set147z = set147z + loop.regs;
+    set146z = set146z - loop.regs;
+    regsUsed = regsUsed + loop.regs;
+    loopHoists.pop_back();
+}
+
+/* An index by the control variable of an enclosing loop, not assigned
+ * so far, is multiplied by the element size once per iteration:
+ * the operand becomes the temporary holding the product.
+ */
+bool useInductionTemp(ExprPtr index, int64_t factor)
+{
+    int64_t & localSize = programme::super.back()->localSize;
+    int64_t & l2int21z = programme::super.back()->l2int21z;
+    int64_t k, offset;
+    size_t t;
+
+    if (not reduceOps or index->op != GETVAR)
+        return false;
+    for (k = int64_t(inductionVars.size()) - 1; k >= 0; --k)
+        if (inductionVars[k].var == index->id1)
+            break;
+    if (k < 0 or inductionVars[k].threats != 0)
+        return false;
+    InductionVar & iv = inductionVars[k];
+    for (t = 0; t < iv.temps.size(); ++t)
+        if (iv.temps[t].first == factor)
+            break;
+    if (t == iv.temps.size()) {
+        iv.temps.push_back(std::make_pair(factor, localSize));
+        localSize = localSize + 1;
+        if (l2int21z < localSize)
+            l2int21z = localSize;
+    }
+    offset = iv.temps[t].second;
+    insnList->ilm = il1;
+    insnList->ilf5.i = curFrameRegTemplate;
+    insnList->ilf6 = offset;
+    insnList->ilf7 = 18;
+    insnList->st = st0;
+    return true;
+}
+
+/* Whether an integer expression is known not to be negative */
+bool nonNegative(ExprPtr e)
+{
+    std::vector<int64_t> uses;
+    int64_t lo, hi;
+    size_t k;
+
+    if (not checkBounds or not valueRange(e, lo, hi, uses) or lo < 0)
+        return false;
+    for (k = 0; k < uses.size(); ++k)
+        ++loopRanges[uses[k]].uses;
+    return true;
+}
+
+/* Sets an integer result, if it fits the 41 bits of the integers */
+bool foldInteger(Word & a, __int128 val)
+{
+    if (val >= (1L << 40) or val <= -(1L << 40))
+        return false;
+    a.ii = 0;
+    a.i = int64_t(val);
+    return true;
+}
+
+/* Computes a binary operation on the constants a and b into a as the
+   code would do it at run time; false if it must be left to the run time,
+   as for a division by zero or an overflow. */
+bool foldBinary(Operator op, Word & a, Word b)
+{
+    Real x, y;
+
+    switch (op) {
+    case MUL:      return besm6Mul(a.r, a.r, b.r);
+    case RDIVOP:   return besm6Div(a.r, a.r, b.r);
+    case PLUSOP:   return besm6Add(a.r, a.r, b.r, false);
+    case MINUSOP:  return besm6Add(a.r, a.r, b.r, true);
+    case IDIVROP:
+        x = a.i;
+        y = b.i;
+        return besm6Div(a.r, x, y);
+    case AMPERS:   a.ii = a.ii and b.ii;
+        break;
+    case OROP:     a.ii = a.ii or b.ii;
+        break;
+    case INTPLUS:  return foldInteger(a, __int128(a.i) + b.i);
+    case INTMINUS: return foldInteger(a, __int128(a.i) - b.i);
+    case IMULOP:   return foldInteger(a, __int128(a.i) * b.i);
+    case IDIVOP:   return b.i != 0 and foldInteger(a, a.i / b.i);
+    case IMODOP:   return b.i != 0 and foldInteger(a, a.i % b.i);
+    case SETAND:   a.m = a.m * b.m;
+        break;
+    case SETOR:    a.m = a.m + b.m;
+        break;
+    case SETXOR:   a.m = a.m ^ b.m;
+        break;
+    case SETSUB:   a.m = a.m - b.m;
+        break;
+    case MKRANGE:
+        if (a.i <= b.i and (a.i < 0 or 47 < b.i))
+            return false;
+        a.m = BitRange(a.i, b.i);
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+/* The comparisons as the code does them: the words for equality,
+   the sign of the difference for the order */
+bool foldComparison(Operator op, TypesPtr typ, Word & a, Word b)
+{
+    Real diff;
+    bool res;
+
+    if (op == INOP)
+        res = a.i >= 0 and b.m.has(a.i);
+    else if (typ->size != 1 or (typ == RealType and fuzzReals))
+        return false;
+    else if (op == EQOP or op == NEOP)
+        res = (a.m == b.m) == (op == EQOP);
+    else if (typ == RealType) {
+        if (not besm6Add(diff, a.r, b.r, true))
+            return false;
+        res = (diff.mantissa < 0) == (op == LTOP);
+    } else if (typ->k == kindSet and op == GEOP)
+        res = b.m <= a.m;
+    else if ((typ->k == kindScalar or typ->k == kindRange) and
+             (op == LTOP or op == GEOP))
+        res = (a.i < b.i) == (op == LTOP);
+    else
+        return false;
+    a.ii = res;
+    return true;
+}
+
+bool foldUnary(Operator op, Word & a)
+{
+    switch (op) {
+    case TOREAL: a.r = a.i;
+        break;
+    case NOTOP:  a.ii = not a.ii;
+        break;
+    case RNEGOP: return besm6Neg(a.r, a.r);
+    case INEGOP: return foldInteger(a, -__int128(a.i));
+    default:
+        return false;
+    }
+    return true;
+}
+
+/* The standard functions of a constant; those done by the library
+   at run time are approximated by the host's */
+bool foldStandard(int64_t fn, Word & a)
+{
+    double d;
+
+    switch (fn) {
+    case fnSQRT:  a.r = sqrt(a.r);
+        break;
+    case fnSIN:   a.r = sin(a.r);
+        break;
+    case fnCOS:   a.r = cos(a.r);
+        break;
+    case fnATAN:  a.r = atan(a.r);
+        break;
+    case fnASIN:  a.r = asin(a.r);
+        break;
+    case fnLN:    a.r = log(a.r);
+        break;
+    case fnEXP:   a.r = exp(a.r);
+        break;
+    case fnABS:   return a.r.mantissa >= 0 or besm6Neg(a.r, a.r);
+    case fnTRUNC:
+        d = trunc(a.r);
+        return fabs(d) < ldexp(1, 40) and foldInteger(a, int64_t(d));
+    case fnODD:   a.ii = a.i & 1;
+        break;
+    case fnORD:   a.m = a.m + Bits(0,1,3); // adding integer exponent
+        break;
+    case fnCHR:   a.m = a.m - Bits(0,1,3); // dropping integer exponent
+        break;
+    case fnSUCC:  a.m.val = (a.m.val + 1) & ((1L<<48)-1);
+        break;
+    case fnPRED:  a.m.val = (a.m.val - 1)  & ((1L<<48)-1);
+        break;
+    case fnPTR:   a.m = a.m - Bits(0,1,3); // bitwise the same as CHR
+        break;
+    case fnSQR:   return besm6Mul(a.r, a.r, a.r);
+    case fnROUND:
+        d = round(a.r);
+        return fabs(d) < ldexp(1, 40) and foldInteger(a, int64_t(d));
+    case fnCARD:  return foldInteger(a, card(a.m));
+    case fnMINEL: return foldInteger(a, minel(a.m));
+    case fnABSI:  return foldInteger(a, std::abs(int64_t(a.i)));
+    case fnSQRI:  return foldInteger(a, __int128(a.i) * a.i);
+    case fnEOF:
+    case fnREF:
+    case fnEOLN:
+        return false;
+    }
+    return true;
+}
+
+struct genFullExpr {
+    static thread_local std::vector<genFullExpr*> super;
+    genFullExpr(ExprPtr exprToGen_);
+    ~genFullExpr() { super.pop_back(); }
+
+    ExprPtr & exprToGen;
+    bool arg1Const, arg2Const;
+    InsnList * otherIns;
+    Word arg1Val, arg2Val;
+    Operator curOP;
+    int64_t work;
+
+    void P5155() {
+        prepLoad();
+        insnList->ilm = il1;
+        insnList->st = st0;
+        insnList->ilf6 = 0;
+        insnList->ilf5.i = 0;
+        insnList->ilf7 = 18;
+    }; /* P5155 */
+
+    void genDeref() {
+        Word l5var1z, l5var2z;
+        bool doPtrCheck;
+
+        doPtrCheck = checkBounds and not (optSflags.m.has(NoPtrCheck))
+            and (curOP == DEREF);
+        if (not doPtrCheck and (
+                (insnList->st == st0) or
                 (insnList->st == st1 and
                  insnList->shift == 0))) {
             l5var1z.i = insnList->ilf7;
@@ -3758,7 +4912,7 @@ L33:        prepLoad();
     }; /* genConstDiv */
 
 };
-std::vector<genFullExpr*> genFullExpr::super;
+thread_local std::vector<genFullExpr*> genFullExpr::super;
 
 void genGetElt()
 {
@@ -3773,15 +4927,26 @@ void genGetElt()
     ilmode l5ilm28z;
     ExprPtr l5var29z;
     InsnListPtr getEltInsns[11]; // array [1..10] of InsnListPtr;
+    ExprPtr getEltExprs[11];
+    LoopHoist * getEltHeld[11];
+    LoopHoist * held;
+    bool read, kept;
     ExprPtr & exprToGen = genFullExpr::super.back()->exprToGen;
     InsnList * &saved = formOperator::super.back()->saved;
 
     dimCnt = 0;
     l5var29z = exprToGen;
     while (l5var29z->op == GETELT) {
+        held = heldIndex(l5var29z->expr2);
+        read = held != NULL and held->read;
         genFullExpr(l5var29z->expr2);
+        /* Read only if it cannot modify through the register */
+        if (held != NULL)
+            held->read = read;
         dimCnt = dimCnt + 1;
+        getEltHeld[dimCnt] = held;
         getEltInsns[dimCnt] = insnList;
+        getEltExprs[dimCnt] = l5var29z->expr2;
         l5var29z = l5var29z->expr1;
     }
     (void) genFullExpr(l5var29z);
@@ -3830,12 +4995,20 @@ void genGetElt()
                     insnCopy.ilf6;
             }
         } else { /* 6123*/
+            held = getEltHeld[curDim];
+            kept = false;
             if (checkBounds) {
                 l5var24z = typeCheck(l5var27z, insnList->typ);
-                if (rangeMismatch)
+                if (rangeMismatch and
+                    not inRange(getEltExprs[curDim], l5var27z))
                     genFullExpr::super.back()->genCheckBounds(l5var27z);
             }
-            if (l5var8z != 1) {
+            if (l5var8z != 1 and l5var27z->base == IntegerType and
+                not packed and useInductionTemp(getEltExprs[curDim], l5var8z)) {
+                /* the product is in the temporary */
+                kept = true;
+            } else if (l5var8z != 1 and not mulByAdds(l5var8z, cost(KMUL) +
+                    (l5var7z >= 0 ? cost(KYTA) : callCost))) {
                 prepLoad();
                 if (l5var27z->base == IntegerType) {
                     l5var4z = KYTA+64;
@@ -3860,9 +5033,8 @@ void genGetElt()
                         insnCopy.ilf7 = 15;
                     } else { /* 6200 */
                         insnCopy.ilf7 = 16;
-                        curInsnTemplate = InsnTemp[WTC];
-                        prepLoad();
-                        curInsnTemplate = InsnTemp[XTA];
+                        if (modifyByIndex(held, l5var8z))
+                            kept = true;
                     }; /* 6205 */
                     insnCopy.next = insnList->next;
                     insnCopy.next2 = insnList->next2;
@@ -3898,9 +5070,8 @@ void genGetElt()
                          if (insnList->ilm == il2) {
                              addInsnAndOffset(macro+mcADDACC2REG, l5var1z);
                          } else {
-                             curInsnTemplate = InsnTemp[WTC];
-                             prepLoad();
-                             curInsnTemplate = InsnTemp[XTA];
+                             if (modifyByIndex(held, l5var8z))
+                                 kept = true;
                              addToInsnList(indexreg[l5var1z] + InsnTemp[UTM]);
                          }
                          insnCopy.next->next = insnList->next2;
@@ -3944,6 +5115,8 @@ void genGetElt()
                     error(errUsingVarAfterIndexingPackedArray);
                 }
             } /* 6403 */
+            if (held != NULL and not kept)
+                held->read = true;
             insnCopy.regsused = l5var23z.m;
         }
         insnCopy.typ = l5var26z;
@@ -4404,7 +5577,7 @@ genFullExpr::genFullExpr(ExprPtr exprToGen_)
     InsnList * &saved = formOperator::super.back()->saved;
     IdentRecPtr &curIdRec = programme::super.back()->curIdRec;
 
-    static int level;
+    static thread_local int level;
     Level l(level);
     
     super.push_back(this);
@@ -4440,49 +5613,7 @@ L7567:
              Bits(GTOP) + Bits(LEOP) + Bits(INOP)).has(curOP)) {
             genComparison();
         } else { /* 7625 */
-            if (arg1Const and arg2Const) {
-                switch (curOP) {
-                case MUL:        arg1Val.r = arg1Val.r * arg2Val.r;
-                    break;
-                case RDIVOP:     arg1Val.r = arg1Val.r / arg2Val.r;
-                    break;
-                case AMPERS:     arg1Val.ii = arg1Val.ii and arg2Val.ii;
-                    break;
-                case IDIVOP:     arg1Val.i = arg1Val.i / arg2Val.i;
-                    break;
-                case IMODOP:     arg1Val.i = arg1Val.i % arg2Val.i;
-                    break;
-                case PLUSOP:     arg1Val.r = arg1Val.r + arg2Val.r;
-                    break;
-                case MINUSOP:    arg1Val.r = arg1Val.r - arg2Val.r;
-                    break;
-                case OROP:       arg1Val.ii = arg1Val.ii or arg2Val.ii;
-                    break;
-                case IMULOP:     arg1Val.i = arg1Val.i * arg2Val.i;
-                    break;
-                case SETAND:     arg1Val.m = arg1Val.m * arg2Val.m;
-                    break;
-                case SETXOR:     arg1Val.m = arg1Val.m ^ arg2Val.m;
-                    break;
-                case INTPLUS:    arg1Val.i = arg1Val.i + arg2Val.i;
-                    break;
-                case INTMINUS:   arg1Val.i = arg1Val.i - arg2Val.i;
-                    break;
-                case SETOR:      arg1Val.m = arg1Val.m + arg2Val.m;
-                    break;
-                case IDIVROP:    arg1Val.r = (double)arg1Val.i / (double)arg2Val.i;
-                    break;
-                case MKRANGE:    arg1Val.m = BitRange(arg1Val.i,arg2Val.i);
-                    break;
-                case SETSUB:
-                    goto L10075;
-                case NEOP: case EQOP: case LTOP: case GEOP: case GTOP: case LEOP: case INOP:
-                case badop27: case badop30: case badop31: case ASSIGNOP:
-                    error(200);
-                    break;
-                default:
-                    break;
-                } /* case 7750 */
+            if (arg1Const and arg2Const and foldBinary(curOP, arg1Val, arg2Val)) {
                 insnList->ilf5 = arg1Val;
             } else { /*7752*/
                 l3int3z = opToMode[curOP];
@@ -4515,7 +5646,7 @@ L7760:              tryFlip(curOP==MUL||curOP==PLUSOP||curOP==SETAND||curOP==INT
                     return;
                 }
                 case opfMOD:
-                    if (arg2Const) {
+                    if (arg2Const and arg2Val.i != 0) {
                         prepLoad();
                         if (card(arg2Val.m) == 4) { // check for integer with 1 bit set, incl. the exponent
                             // compute the mask
@@ -4538,7 +5669,18 @@ L7760:              tryFlip(curOP==MUL||curOP==PLUSOP||curOP==SETAND||curOP==INT
                     };
                     break;
                 case opfDIV: {
-                    if (arg2Const) {
+                    if (reduceOps and arg2Const and arg2Val.i > 0 and
+                        (arg2Val.i & (arg2Val.i - 1)) == 0 and
+                        nonNegative(exprToGen->expr1)) {
+                        /* Scale by the exponent and align to the integers */
+                        prepLoad();
+                        for (work = 0; (1L << work) != arg2Val.i; ++work);
+                        if (work != 0) {
+                            addToInsnList(InsnTemp[ESUBI] + 64 + work);
+                            addToInsnList(KADD+ZERO);
+                        }
+                        l3int3z = 1;
+                    } else if (arg2Const and arg2Val.i != 0) {
                         prepLoad();
                         genConstDiv();
                         l3int3z = 1;
@@ -4546,6 +5688,15 @@ L7760:              tryFlip(curOP==MUL||curOP==PLUSOP||curOP==SETAND||curOP==INT
                         genHelper();
                 } break;
                 case opfMULMSK: {
+                    if (arg1Const != arg2Const) {
+                        if (arg1Const)
+                            std::swap(insnList, otherIns);
+                        if (mulByAdds(arg1Const ? arg1Val.i : arg2Val.i,
+                                      cost(KMUL) + (fixMult ? callCost : cost(KYTA))))
+                            break;
+                        if (arg1Const)
+                            std::swap(insnList, otherIns);
+                    }
                     if (arg1Const) {
                         insnList->ilf5.m = arg1Val.m ^ Bits(1, 3);
                     } else {
@@ -4564,7 +5715,7 @@ L7760:              tryFlip(curOP==MUL||curOP==PLUSOP||curOP==SETAND||curOP==INT
                         addToInsnList(KYTA+64);
                 } break;
                 case opfINV: {
-L10075:             saved = insnList;
+                    saved = insnList;
                     insnList = otherIns;
                     otherIns = saved;
                     prepLoad();
@@ -4581,6 +5732,9 @@ L10122:
             if (curOP == GETVAR) {
                 insnList = new InsnList;
                 curIdRec = exprToGen->id1;
+                for (auto & loop : loopHoists)
+                    if (loop.var == curIdRec)
+                        loop.read = true;
                 insnList->next = NULL;
                 insnList->next2 = NULL;
                 insnList->regsused = Bits();
@@ -4645,33 +5799,21 @@ L10122:
             genEntry();
         else if (BOUNDS <= curOP && curOP <= RNEGOP) {
             genFullExpr(exprToGen->expr1);
-            if (insnList->ilm == ilCONST) {
-                arg1Val = insnList->ilf5;
-                switch (curOP) {
-                case BOUNDS:
-                    arg2Val.m = Bits(0,1,3) + arg1Val.m;
-                    if ((arg2Val.i < exprToGen->typ2->cast<RangeT>().left) or
-                        (exprToGen->typ2->cast<RangeT>().right < arg2Val.i))
-                        error(errNeedOtherTypesOfOperands);
-                    break;
-                case TOREAL: arg1Val.r = arg1Val.i;
-                    break;
-                case NOTOP: arg1Val.ii = not arg1Val.ii;
-                    break;
-                case RNEGOP: arg1Val.r = -arg1Val.r;
-                    break;
-                case INEGOP: arg1Val.i = -arg1Val.i;
-                    break;
-                default:
-                    break;
-                }; /* case 10345 */
+            arg1Val = insnList->ilf5;
+            if (insnList->ilm == ilCONST and curOP == BOUNDS) {
+                arg2Val.m = Bits(0,1,3) + arg1Val.m;
+                if ((arg2Val.i < exprToGen->typ2->cast<RangeT>().left) or
+                    (exprToGen->typ2->cast<RangeT>().right < arg2Val.i))
+                    error(errNeedOtherTypesOfOperands);
+            } else if (insnList->ilm == ilCONST and foldUnary(curOP, arg1Val)) {
                 insnList->ilf5 = arg1Val;
             } else if (curOP == NOTOP) {
                 negateCond();
             } else {
                 prepLoad();
                 if (curOP == BOUNDS) {
-                    if (checkBounds)
+                    if (checkBounds and
+                        not inRange(exprToGen->expr1, static_cast<RangeT*>(exprToGen->typ2)))
                         genCheckBounds(static_cast<RangeT*>(exprToGen->typ2));
                 } else if (curOP == TOREAL) {
                     addToInsnList(InsnTemp[AVX]);
@@ -4700,56 +5842,7 @@ L10122:
                 } else
                     arg1Const = false;
                 arg2Const = (insnList->typ == RealType);
-                if (arg1Const) {
-                    switch (work) {
-                    case fnSQRT:  arg1Val.r = sqrt(arg1Val.r);
-                        break;
-                    case fnSIN:   arg1Val.r = sin(arg1Val.r);
-                        break;
-                    case fnCOS:   arg1Val.r = cos(arg1Val.r);
-                        break;
-                    case fnATAN:  arg1Val.r = atan(arg1Val.r);
-                        break;
-                    case fnASIN:  arg1Val.r = asin(arg1Val.r);
-                        break;
-                    case fnLN:    arg1Val.r = log(arg1Val.r);
-                        break;
-                    case fnEXP:   arg1Val.r = exp(arg1Val.r);
-                        break;
-                    case fnABS:   arg1Val.r = fabs(arg1Val.r);
-                        break;
-                    case fnTRUNC: arg1Val.i = int64_t(trunc(arg1Val.r));
-                        break;
-                    case fnODD:   arg1Val.ii = arg1Val.i & 1;
-                        break;
-                    case fnORD:   arg1Val.m = arg1Val.m + Bits(0,1,3); // adding integer exponent
-                        break;
-                    case fnCHR:   arg1Val.m = arg1Val.m - Bits(0,1,3); // dropping integer exponent
-                        break;
-                    case fnSUCC:  arg1Val.m.val = (arg1Val.m.val + 1) & ((1L<<48)-1);
-                        break;
-                    case fnPRED:  arg1Val.m.val = (arg1Val.m.val - 1)  & ((1L<<48)-1);
-                        break;
-                    case fnPTR:   arg1Val.m = arg1Val.m - Bits(0,1,3); // bitwise the same as CHR
-                        break;
-                    case fnSQR:   arg1Val.r = arg1Val.r*arg1Val.r;
-                        break;
-                    case fnROUND: arg1Val.i = int64_t(round(arg1Val.r));
-                        break;
-                    case fnCARD:  arg1Val.i = card(arg1Val.m);
-                        break;
-                    case fnMINEL: arg1Val.i = minel(arg1Val.m);
-                        break;
-                    case fnABSI:  arg1Val.i = labs(arg1Val.i);
-                        break;
-                    case fnSQRI:  arg1Val.i = arg1Val.i*arg1Val.i;
-                        break;
-                    case fnEOF:
-                    case fnREF:
-                    case fnEOLN:
-                        error(201);
-                        break;
-                    } /* 10546 */
+                if (arg1Const and foldStandard(work, arg1Val)) {
                     insnList->ilf5 = arg1Val;
                 } else if ((work >= fnEOF) and (fnEOLN >= work)) {
                     if (work == fnREF) {
@@ -4859,6 +5952,7 @@ void formFileInit()
 
 formOperator::formOperator(OpGen op)
 { /* formOperator */
+    PhaseTimer timer(stats.codegen);
     super.push_back(this);
     l3bool13z = true;
     if ((errors and (op != SETREG)) or curExpr == NULL)
@@ -4867,6 +5961,7 @@ formOperator::formOperator(OpGen op)
         op != STRUCTASSN &&
         op != MKINT &&
         op != FILEINIT &&
+        op != ADDRTOREG &&
         op!=PCKUNPCK)
         (void) genFullExpr(curExpr);
     switch (op) {
@@ -4949,6 +6044,12 @@ formOperator::formOperator(OpGen op)
         (void) setAddrTo(12);
         genOneOp();
     } break;
+    case ADDRTOREG: {
+        l3int1z = curVal.i;
+        (void) genFullExpr(curExpr);
+        (void) setAddrTo(l3int1z);
+        genOneOp();
+    } break;
     case MKINT: {
         curVal.i = curVal.ii;
         form1Insn(KXTA+I8 + getFCSToffset());
@@ -5069,7 +6170,7 @@ formOperator::formOperator(OpGen op)
 } /* formOperator */
 
 struct parseTypeRef {
-    static std::vector<parseTypeRef*> super;
+    static thread_local std::vector<parseTypeRef*> super;
     parseTypeRef(TypesPtr & newType, Bitset skipTarget_);
     ~parseTypeRef() { super.pop_back(); }
     typedef std::pair<int64_t, int64_t> pair;
@@ -5098,10 +6199,10 @@ struct parseTypeRef {
         typelist = curEnum;
     } /* definExprPtrType */
 };
-std::vector<parseTypeRef*> parseTypeRef::super;
+thread_local std::vector<parseTypeRef*> parseTypeRef::super;
 
 struct parseRecordDecl {
-    static std::vector<parseRecordDecl*> super;
+    static thread_local std::vector<parseRecordDecl*> super;
     parseRecordDecl(TypesPtr rectype, bool isOuterDecl_);
     ~parseRecordDecl() { super.pop_back(); }
 
@@ -5118,14 +6219,13 @@ struct parseRecordDecl {
         TypesPtr &curType = parseTypeRef::super.back()->curType;
         bool &isPacked = parseTypeRef::super.back()->isPacked;
         curEnum->id = curIdent;
-        curEnum->next = typeHashTabBase[bucket];
         curEnum->cl = FIELDID;
         curEnum->uptype() = curType;
         curEnum->pckfield() = isPacked;
-        typeHashTabBase[bucket] = curEnum;
+        linkIdent(typeHashTabBase[bucket], curEnum);
     }
 };
-std::vector<parseRecordDecl*> parseRecordDecl::super;
+thread_local std::vector<parseRecordDecl*> parseRecordDecl::super;
 
 void packFields()
 {
@@ -5198,19 +6298,19 @@ L11523:             l5var6z = &cases.pairs[pairIdx];
         cases.size = cases.size + selType->size;
 L11622:
         if (PASINFOR.listMode == 3) {
-            printf("%16c", ' ');
+            fprintf(listing, "%16c", ' ');
             if (curField->pckfield())
-                printf("PACKED");
-            printf(" FIELD ");
+                fprintf(listing, "PACKED");
+            fprintf(listing, " FIELD ");
             printTextWord(curField->id);
-            printf(".OFFSET=%05loB", curField->offset);
+            fprintf(listing, ".OFFSET=%05loB", curField->offset);
             if (curField->pckfield()) {
-                printf(".<<=SHIFT=%2ld. WIDTH=%2ld BITS", curField->shift(),
+                fprintf(listing, ".<<=SHIFT=%2ld. WIDTH=%2ld BITS", curField->shift(),
                        curField->width());
             } else {
-                printf(".WORDS=%ld", selType->size);
+                fprintf(listing, ".WORDS=%ld", selType->size);
             }
-            putchar('\n');
+            putc('\n', listing);
         }
         cond = (curField == curEnum);
         curField = curField->list();
@@ -5387,9 +6487,8 @@ L12247:
             if (isDefined)
                 error(errIdentAlreadyDefined);
             curEnum = new IdentRec(curIdent, curFrameRegTemplate,
-                                   symHashTabBase[bucket], curType,
-                                   ENUMID, NULL, span);
-            symHashTabBase[bucket] = curEnum;
+                                   NULL, curType, ENUMID, NULL, span);
+            linkIdent(symHashTabBase[bucket], curEnum);
             span = span + 1;
             if (curField == NULL) {
                 scalar.enums = curEnum;
@@ -5643,6 +6742,19 @@ void formPMD()
     IdentRecPtr &l2idr2z = programme::super.back()->l2idr2z;
     IdentRecPtr &curIdRec = programme::super.back()->curIdRec;
 
+    // The identifiers declared after the routine, listed as they were
+    // found in the 128 chains of the original hash table.
+    std::vector<IdentRecPtr> locals;
+    for (int jj = 0; jj < HASH_SIZE; ++jj) {
+        for (curIdRec = symHashTabBase[jj];
+             curIdRec != NULL and l2idr2z < curIdRec; curIdRec = curIdRec->next)
+            locals.push_back(curIdRec);
+    }
+    std::sort(locals.begin(), locals.end(), [](IdentRecPtr a, IdentRecPtr b) {
+        int64_t ba = (a->id % 65535) % 128, bb = (b->id % 65535) % 128;
+        return ba != bb ? ba < bb : b < a;
+    });
+
     for (int bb = 0; bb <= 1; ++bb) {
         l3var4z = bb;
         if (l3var4z) {
@@ -5654,49 +6766,46 @@ void formPMD()
             curVal.i = lineCnt;
             toFCST();
         } /* 13063 */
-        for (int jj = 0; jj <= 127; ++jj)  {
-            curIdRec = symHashTabBase[jj];
+        for (size_t jj = 0; jj < locals.size(); ++jj)  {
+            curIdRec = locals[jj];
             /*13066*/
-            while (curIdRec != NULL and l2idr2z < curIdRec) {
-                if (curIdRec->typ != NULL) // check added; in the BESM-6 dereferencing NULL is OK
-                    l3var2z.i = curIdRec->typ->size;
-                if ((curIdRec->cl == VARID || curIdRec->cl == FORMALID) and
-                    (curIdRec->value() < 074000)) {
-                    curVal.ii = curIdRec->id;
-                    if (l3var4z)
-                        toFCST();
-                    l3typ1z = curIdRec->typ;
+            if (curIdRec->typ != NULL) // check added; in the BESM-6 dereferencing NULL is OK
+                l3var2z.i = curIdRec->typ->size;
+            if ((curIdRec->cl == VARID || curIdRec->cl == FORMALID) and
+                (curIdRec->value() < 074000)) {
+                curVal.ii = curIdRec->id;
+                if (l3var4z)
+                    toFCST();
+                l3typ1z = curIdRec->typ;
+                l3var5z = l3typ1z->k;
+                l3var3z = Bits();
+                if (l3var5z == kindPtr) {
+                    l3typ1z = l3typ1z->cast<PtrT>().pbase;
                     l3var5z = l3typ1z->k;
-                    l3var3z = Bits();
-                    if (l3var5z == kindPtr) {
-                        l3typ1z = l3typ1z->cast<PtrT>().pbase;
-                        l3var5z = l3typ1z->k;
-                        l3var3z = Bits(0);
-                    }
-                    if (l3typ1z == RealType)
-                        curVal.i = 0;
-                    else if (typeCheck(l3typ1z, IntegerType))
-                        curVal.i = 0100000;
-                    else if (typeCheck(l3typ1z, CharType))
-                        curVal.i = 0200000;
-                    else if (l3var5z == kindArray)
-                        curVal.i = 0400000;
-                    else if (l3var5z == kindScalar) {
-                        dumpEnumNames(static_cast<ScalarT*>(l3typ1z));
-                        curVal.i = 01000000 * l3typ1z->cast<ScalarT>().start + 0300000;
-                    } else if (l3var5z == kindFile)
-                        curVal.i = 0600000;
-                    else {
-                        curVal.i = 0500000;
-                    }
-                    curVal.i = curVal.i + curIdRec->value();
-                    l3var2z.m = l3var2z.m << 33;
-                    curVal.m = curVal.m * BitRange(15,47) + l3var2z.m + l3var3z;
-                    if (l3var4z)
-                        toFCST();
-                } /* 13164 */
-                curIdRec = curIdRec->next;
-            } /* 13166 */
+                    l3var3z = Bits(0);
+                }
+                if (l3typ1z == RealType)
+                    curVal.i = 0;
+                else if (typeCheck(l3typ1z, IntegerType))
+                    curVal.i = 0100000;
+                else if (typeCheck(l3typ1z, CharType))
+                    curVal.i = 0200000;
+                else if (l3var5z == kindArray)
+                    curVal.i = 0400000;
+                else if (l3var5z == kindScalar) {
+                    dumpEnumNames(static_cast<ScalarT*>(l3typ1z));
+                    curVal.i = 01000000 * l3typ1z->cast<ScalarT>().start + 0300000;
+                } else if (l3var5z == kindFile)
+                    curVal.i = 0600000;
+                else {
+                    curVal.i = 0500000;
+                }
+                curVal.i = curVal.i + curIdRec->value();
+                l3var2z.m = l3var2z.m << 33;
+                curVal.m = curVal.m * BitRange(15,47) + l3var2z.m + l3var3z;
+                if (l3var4z)
+                    toFCST();
+            } /* 13164 */
         } /*13167+*/
         curVal.m = Bits();
         if (l3var4z)
@@ -5793,7 +6902,7 @@ void parseDecls(int64_t l3arg1z)
 } /* parseDecls */
 
 struct Statement {
-    static std::vector<Statement*> super;
+    static thread_local std::vector<Statement*> super;
     Statement();
     ~Statement() { super.pop_back(); }
 
@@ -5808,9 +6917,11 @@ struct Statement {
     int64_t l3var10z;
     int64_t l3var11z;
     IdentRecPtr l3idr12z;
+    ExprPtr l4exp1z;
+    Bitset sharedRegs;          // holding the addresses of shareAddresses
 };
 
-std::vector<Statement*> Statement::super;
+thread_local std::vector<Statement*> Statement::super;
 
 bool isCharArray(TypesPtr arg)
 {
@@ -5818,6 +6929,7 @@ bool isCharArray(TypesPtr arg)
 } /* isCharArray */
 
 void expression();
+void parseCall(IdentRecPtr routine);
 
 void parseLval()
 {
@@ -5833,6 +6945,9 @@ void parseLval()
         curExpr->typ = hashTravPtr->typ;
         curExpr->op = GETVAR;
         curExpr->id1 = hashTravPtr;
+        if (hashTravPtr->cl == VARID and
+            hashTravPtr->offset != curFrameRegTemplate)
+            upLevelVars.insert(int64_t(hashTravPtr), 1);
 L13462:
         inSymbol();
         l4typ3z = curExpr->typ;
@@ -5957,6 +7072,8 @@ void parseCallArgs(IdentRecPtr l4arg1z)
             }
             bool47z = true;
             expression();
+            if (not l4var1z or l4idr5z->cl != VARID)
+                noteAssigned(curExpr);
             l4op6z = curExpr->op;
             /* (a) */
             if (l4var1z) {
@@ -6169,13 +7286,13 @@ struct Factor {
                             }
                         } else /* 14330 */ {
                             if (SY == LPAREN) {
-                                parseCallArgs(routine);
+                                parseCall(routine);
                                 return;
                             }
                             if (l4var2z) {
                                 l4op10z = FCALL;
                             } else {
-                                parseCallArgs(routine);
+                                parseCall(routine);
                                 return;
                             }
                         } /* 14342 */
@@ -6452,6 +7569,41 @@ L15031:     error(errNeedOtherTypesOfOperands);
     }
 } /* simpleExpression */
 
+/* Replaces the operations on constants in e by their values, bottom up,
+   so that neither the analyses nor the code generator meet them */
+void foldConst(ExprPtr e)
+{
+    Word val;
+
+    if (e == NULL)
+        return;
+    if (e->op < ASSIGNOP) {
+        foldConst(e->expr1);
+        foldConst(e->expr2);
+        if (e->expr1->op != GETENUM or e->expr2->op != GETENUM)
+            return;
+        val = e->expr1->d1;
+        if ((Bits(NEOP, EQOP, LTOP, GEOP) + Bits(GTOP, LEOP, INOP)).has(e->op)) {
+            if (not foldComparison(e->op, e->expr1->typ, val, e->expr2->d1))
+                return;
+        } else if (not foldBinary(e->op, val, e->expr2->d1))
+            return;
+    } else if (TOREAL <= e->op and e->op <= STANDPROC) {
+        foldConst(e->expr1);
+        if (e->expr1 == NULL or e->expr1->op != GETENUM or
+            (e->op == STANDPROC and 100 < e->num2))
+            return;
+        val = e->expr1->d1;
+        if (e->op == STANDPROC ? not foldStandard(e->num2, val)
+                               : not foldUnary(e->op, val))
+            return;
+    } else
+        return;
+    e->op = GETENUM;
+    e->d1 = val;
+    e->num2 = 0;
+}
+
 void expression()
 {
     Operator oper;
@@ -6503,14 +7655,45 @@ void expression()
         }
         curExpr = l4var2z;
     }
+    foldConst(curExpr);
 } /* expression */
 
+/* Checks the control variable of a loop against its range */
+void checkLoopVar(LoopRange & r)
+{
+    TypesPtr range;
+    ExprPtr var;
+
+    range = r.var->typ;
+    if (range->k == kindRange)
+        range = range->cast<RangeT>().base;
+    defineRange(range, r.lo, r.hi);
+    var = new Expr;
+    var->typ = r.var->typ;
+    var->op = GETVAR;
+    var->id1 = r.var;
+    curExpr = new Expr;
+    curExpr->typ = r.var->typ;
+    curExpr->op = BOUNDS;
+    curExpr->expr1 = var;
+    curExpr->typ2 = range;
+    (void) formOperator(LOAD);
+}
+
 void forStatement()
 {
     TypesPtr l4typ1z;
     ExprPtr l4exp2z, l4var3z, l4var4z;
     int64_t l4int5z, l4int6z, l4int7z, l4int8z;
     bool l4var9z;
+    std::vector<LoopRange> outer;
+    std::vector<int64_t> uses, counted;
+    LoopRange range;
+    InductionVar induction;
+    int64_t startLo, startHi, limLo, limHi, labels, reg, done;
+    int64_t entry = 0, back = 0;
+    bool ranged, recheck, inducted, stub, countable, held, read;
+    size_t k;
 
     inSymbol();
     disableNorm();
@@ -6528,6 +7711,7 @@ void forStatement()
     if (curExpr == NULL)
         curExpr = uVarPtr;
     l4exp2z = curExpr;
+    noteAssigned(l4exp2z);
     l4typ1z = l4exp2z->typ;
     if (not (l4typ1z->k == kindScalar || l4typ1z->k == kindRange))
         error(25); /* errExprNotOfADiscreteType */
@@ -6556,6 +7740,47 @@ void forStatement()
     expression();
     if (not typeCheck(l4typ1z, curExpr->typ))
         error(31); /* errIncompatibleTypesOfLoopIndexAndExpr */
+    /* A local variable no other routine can change keeps
+     * within the bounds while the loop runs, unless assigned.
+     */
+    ranged = checkBounds and l4var9z and l4exp2z->op == GETVAR and
+        l4exp2z->id1->cl == VARID and
+        l4exp2z->id1->offset == curFrameRegTemplate and
+        l4exp2z->id1->value() < 074000 and
+        upLevelVars.find(int64_t(l4exp2z->id1)) < 0 and
+        valueRange(l4var3z, startLo, startHi, uses) and
+        valueRange(curExpr, limLo, limHi, uses);
+    if (ranged) {
+        for (k = 0; k < uses.size(); ++k)
+            ++loopRanges[uses[k]].uses;
+        range.var = l4exp2z->id1;
+        if (l4int6z == InsnTemp[SUB]) {
+            range.lo = limLo;
+            range.hi = startHi;
+        } else {
+            range.lo = startLo;
+            range.hi = limHi;
+        }
+        range.depth = condLoopDepth;
+        range.labels = labelsSeen;
+        range.uses = range.threats = 0;
+    }
+    inducted = l4exp2z->op == GETVAR and
+        l4exp2z->id1->cl == VARID and
+        l4exp2z->id1->offset == curFrameRegTemplate and
+        l4exp2z->id1->value() < 074000 and
+        upLevelVars.find(int64_t(l4exp2z->id1)) < 0 and
+        l4int5z == KATX+PLUS1;
+    if (inducted) {
+        induction.var = l4exp2z->id1;
+        induction.threats = 0;
+        induction.stale = false;
+    }
+    /* Up to a constant, the count must fit a register */
+    countable = inducted and l4var9z and l4int6z == InsnTemp[ADD] and
+        valueRange(curExpr, limLo, limHi, counted) and limLo == limHi and
+        valueRange(l4var3z, startLo, startHi, counted) and
+        limHi - startLo < 077777;
     (void) formOperator(gen0);
     l4var4z = curExpr;
     if (l4var9z) {
@@ -6569,22 +7794,149 @@ void forStatement()
     formJump(l4int7z);
     padToLeft();
     l4int8z = moduleOffset;
+    outer = loopRanges;
+    labels = labelsSeen;
+    if (ranged)
+        loopRanges.push_back(range);
+    if (inducted)
+        inductionVars.push_back(induction);
+    openLoop(0, false);
+    LoopHoist & loop = loopHoists.back();
+    held = countable and loop.plain and set148z * set147z != Bits() and
+        std::find(loop.assigned.begin(), loop.assigned.end(),
+                  l4exp2z->id1->id) == loop.assigned.end();
+    reg = 0;
+    if (held) {
+        for (k = 0; k < counted.size(); ++k)
+            ++loopRanges[counted[k]].uses;
+        reg = minel(set148z * set147z);
+        loop.var = l4exp2z->id1;
+        loop.reg = reg;
+        loop.limit = limHi;
+        loop.regs = loop.regs + Bits(reg);
+        set147z = set147z - Bits(reg);
+    }
+    if (l4exp2z->op == GETVAR)
+        loop.assigned.push_back(l4exp2z->id1->id);
     checkSymAndRead(DOSY);
     Statement();
     disableNorm();
+    if (inducted) {
+        induction = inductionVars.back();
+        inductionVars.pop_back();
+        inducted = not induction.temps.empty();
+    }
+    read = loopHoists.back().read;
+    loopHoists.back().var = NULL;
+    /* The addresses the loop keeps are formed there too */
+    stub = held or inducted or not loopHoists.back().addrs.empty();
+    /* The products step with the variable; they are first computed
+     * on the way from the initial value to the loop condition.
+     */
+    for (k = 0; inducted and k < induction.temps.size(); ++k) {
+        form1Insn(KXTA + curFrameRegTemplate + induction.temps[k].second);
+        curVal.i = induction.temps[k].first;
+        form1Insn(l4int6z + I8 + getFCSToffset());
+        form1Insn(KATX + curFrameRegTemplate + induction.temps[k].second);
+    }
     curExpr = l4exp2z;
-    (void) formOperator(LOAD);
-    form1Insn(l4int6z + l4int5z);
-    P0715(0, l4int7z);
-    (void) formOperator(STORE);
-    curExpr = l4var4z;
-    if (l4int6z == InsnTemp[SUB])
-        curVal.i = l4int6z;
+    if (held) {
+        /* The register counts; the variable is stepped if read */
+        if (read) {
+            (void) formOperator(LOAD);
+            form1Insn(l4int6z + l4int5z);
+            curExpr = l4exp2z;
+            (void) formOperator(STORE);
+        }
+        entry = l4int7z;
+    } else {
+        (void) formOperator(LOAD);
+        form1Insn(l4int6z + l4int5z);
+        if (stub) {
+            entry = l4int7z;
+            padToLeft();
+            back = moduleOffset;
+        } else
+            P0715(0, l4int7z);
+        (void) formOperator(STORE);
+        curExpr = l4var4z;
+        if (l4int6z == InsnTemp[SUB])
+            curVal.i = l4int6z;
+        else
+            curVal.i = InsnTemp[RSUB];
+        /*15401*/
+        (void) formOperator(LOOPCOND);
+    }
+    /* The variables assigned after their ranges have been relied upon
+     * are checked before the next iteration.
+     */
+    recheck = false;
+    l4int7z = 0;
+    done = 0;
+    for (k = 0; k < loopRanges.size(); ++k) {
+        range = k < outer.size() ? outer[k] : LoopRange();
+        if (loopRanges[k].uses > range.uses and
+            (loopRanges[k].threats > range.threats or labelsSeen != labels)) {
+            if (not recheck) {
+                if (held) {
+                    jumpType = KVZM + indexreg[reg];
+                    formJump(done);
+                } else {
+                    jumpType = InsnTemp[U1A];
+                    formJump(l4int7z);
+                }
+                jumpType = InsnTemp[UJ];
+                recheck = true;
+            }
+            checkLoopVar(loopRanges[k]);
+        }
+    }
+    if (held) {
+        form1Insn(KVLM + indexreg[reg] + l4int8z);
+        if (recheck)
+            P0715(0, done);
+        if (not read) {
+            curVal.i = limHi + 1;
+            form1Insn(KXTA+I8 + getFCSToffset());
+            curExpr = l4exp2z;
+            (void) formOperator(STORE);
+        }
+    } else if (recheck)
+        form1Insn(InsnTemp[UJ] + l4int8z);
     else
-        curVal.i = InsnTemp[RSUB];
-    /*15401*/
-    (void) formOperator(LOOPCOND);
-    form1Insn(InsnTemp[UZA] + l4int8z);
+        form1Insn(InsnTemp[UZA] + l4int8z);
+    if (stub) {
+        formJump(l4int7z);
+        P0715(0, entry);
+        curExpr = l4exp2z;
+        (void) formOperator(STORE);
+        if (held) {
+            /* Not entered if the start is past the limit */
+            disableNorm();
+            curVal.i = limHi + 1;
+            form1Insn(InsnTemp[SUB] + I8 + getFCSToffset());
+            jumpType = InsnTemp[UZA];
+            formJump(l4int7z);
+            jumpType = InsnTemp[UJ];
+            form2Insn(KATI + reg, KUTM + indexreg[reg] + 1);
+        }
+        for (k = 0; inducted and k < induction.temps.size(); ++k)
+            storeProduct(induction.var, induction.temps[k].first,
+                         induction.temps[k].second);
+        loadHoisted(loopHoists.back());
+        if (held)
+            form1Insn(InsnTemp[UJ] + l4int8z);
+        else {
+            curExpr = l4exp2z;
+            (void) formOperator(LOAD);
+            form1Insn(InsnTemp[UJ] + back);
+        }
+    }
+    if (recheck or stub)
+        P0715(0, l4int7z);
+    closeLoop(0);
+    if (ranged)
+        loopRanges.pop_back();
 } /* forStatement */
 
 void withStatement()
@@ -6617,7 +7969,11 @@ void withStatement()
     Statement();
     expr63z = l4exp1z;
     localSize = l4var4z;
-    set147z = l4var2z;
+    /* The products taken in the body step with their loops still */
+    for (auto & iv : inductionVars)
+        for (auto & temp : iv.temps)
+            localSize = std::max(localSize, temp.second + 1);
+    set147z = l4var2z - hoistedRegs();
     regsUsed = regsUsed + l4var3z;
 } /* withStatement */
 
@@ -6625,7 +7981,7 @@ void reportStmtType(int64_t)
 {
     int64_t &startLine = Statement::super.back()->startLine;
 
-    printf(" STATEMENT %s IN %ld LINE\n", stmtName.c_str(), startLine);
+    fprintf(listing, " STATEMENT %s IN %ld LINE\n", stmtName.c_str(), startLine);
 }
 
 bool structBranch(bool isGoto)
@@ -6681,25 +8037,65 @@ bool structBranch(bool isGoto)
     return ret;
 } /* structBranch */
 
+typedef struct CaseClause : public BESM6Obj {
+    CaseClause * next;
+    Word value;
+    int64_t offset;
+} * CaseClausePtr;
+
+const int64_t CASE_TABLE_MAX = 1024;
+
+/* Binary search over cnt sorted clauses, the selector being in SP+1;
+ * the last few are compared one by one.
+ */
+void caseTree(CaseClausePtr clause, int64_t cnt,
+              int64_t otherOffset, int64_t & endOfStmt)
+{
+    CaseClausePtr mid;
+    int64_t lower, i;
+
+    if (cnt <= 3) {
+        for (; cnt != 0; --cnt) {
+            form1Insn(KXTA+SP+1);
+            curVal = clause->value;
+            form2Insn(KAEX + I8 + getFCSToffset(),
+                      InsnTemp[UZA] + clause->offset);
+            clause = clause->next;
+        }
+        if (otherOffset >= 0)
+            form1Insn(InsnTemp[UJ] + otherOffset);
+        else
+            formJump(endOfStmt);
+        return;
+    }
+    mid = clause;
+    for (i = cnt / 2; i != 0; --i)
+        mid = mid->next;
+    form1Insn(KXTA+SP+1);
+    curVal = mid->value;
+    form1Insn(KSUB+I8 + getFCSToffset());
+    lower = 0;
+    jumpType = InsnTemp[U1A];
+    formJump(lower);
+    jumpType = InsnTemp[UJ];
+    caseTree(mid, cnt - cnt / 2, otherOffset, endOfStmt);
+    P0715(0, lower);
+    caseTree(clause, cnt / 2, otherOffset, endOfStmt);
+}
+
 void caseStatement()
 {
-    typedef struct CaseClause : public BESM6Obj {
-        CaseClause * next;
-        Word value;
-        int64_t offset;
-    } * CaseClausePtr;
-
     CaseClausePtr allClauses, curClause, clause, old = NULL;
-    bool isIntCase;
     bool otherSeen;
     int64_t otherOffset = -1;
     bool itemsEnded, goodMode;
     TypesPtr firstType, itemtype, exprtype;
     Word itemvalue;
     int64_t itemSpan;
-    Word expected;
     int64_t startLine, l4var17z, endOfStmt;
     Word minValue, maxValue;
+    int64_t clauseCnt, valueSpan, value, strategy;
+    bool tableFits;
 
     startLine = lineCnt;
     expression();
@@ -6784,90 +8180,632 @@ void caseStatement()
         error(88); /* errDifferentTypesOfLabelsAndExpr */;
         return;
     }
-    padToLeft();
-    isIntCase = typeCheck(exprtype, IntegerType);
-    if (allClauses != NULL) {
-        expected = allClauses->value;
-        minValue = expected;
-        curClause = allClauses;
-        while (curClause != NULL) {
-            if (expected == curClause->value and
-                exprtype->k == kindScalar) {
-                maxValue = expected;
-                if (isIntCase) {
-                    expected.i = expected.i + 1; // Integers with exponent
-                } else {
-                    curVal = expected;
-                    curVal.ii = curVal.ii + 1; // Integers without exponent
-                    expected = curVal;
-                }
-                curClause = curClause->next;
-            } else {
-                itemSpan = 34000;
-                P0715(0, l4var17z);
-                if (firstType->k == kindRange) {
-                    itemSpan = std::max(std::abs(firstType->cast<RangeT>().left),
-                                        std::abs(firstType->cast<RangeT>().right));
-                } else {
-                    if (firstType->k == kindScalar)
-                        itemSpan = firstType->cast<ScalarT>().numen;
-                }
-                itemsEnded = (itemSpan < 32000);
-                if (itemsEnded) {
-                    form1Insn(KATI+14);
-                } else {
-                    form1Insn(KATX+SP+1);
-                }
-                minValue.i = (minValue.i - minValue.i); /* WTF? */
-                while (allClauses != NULL) {
-                    if (itemsEnded) {
-                        curVal.i = (minValue.i - allClauses->value.i);
-                        curVal.i = curVal.ii;
-                        form1Insn(getValueOrAllocSymtab(curVal.i) +
-                                  (KUTM+I14));
-                        form1Insn(KVZM+I14 + allClauses->offset);
-                        minValue = allClauses->value;
-                    } else {
-                        form1Insn(KXTA+SP+1);
-                        curVal = allClauses->value;
-                        form2Insn(KAEX + I8 + getFCSToffset(),
-                                  InsnTemp[UZA] + allClauses->offset);
-                    }
-                    allClauses = allClauses->next;
-                }
-                if (otherSeen)
-                    form1Insn(InsnTemp[UJ] + otherOffset);
-                goto L16211;
-            } /* if 16141 */
-        } /* while 16142 */
-        if (not otherSeen) {
-            otherOffset = moduleOffset;
-            formJump(endOfStmt);
-        }
-        P0715(0, l4var17z);
-        curVal = minValue;
-        P0715(-(InsnTemp[U1A]+otherOffset), maxValue.i);
-        curVal = minValue;
-        curVal.i = curVal.ii;
-        form1Insn(KATI+14);
-        curVal.i = ((moduleOffset + (1)) - curVal.i);
-        if (curVal.i < 040000) {
-            curVal.i = (curVal.i - 040000);
-            curVal.i = allocSymtab(041000000 | (curVal.ii & 077777));
-        }
-        form1Insn(KUJ+I14 + curVal.i);
-        while (allClauses != NULL) {
-            padToLeft();
-            form1Insn(InsnTemp[UJ] + allClauses->offset);
-            allClauses = allClauses->next;
+    padToLeft();
+    if (allClauses != NULL) {
+        minValue = allClauses->value;
+        clauseCnt = 0;
+        curClause = allClauses;
+        while (curClause != NULL) {
+            maxValue = curClause->value;
+            clauseCnt = clauseCnt + 1;
+            curClause = curClause->next;
+        }
+        valueSpan = maxValue.i - minValue.i + 1;
+        tableFits = exprtype->k == kindScalar and valueSpan <= CASE_TABLE_MAX;
+        strategy = caseMode;
+        if (strategy == 3 and not tableFits)
+            strategy = 0;
+        /* The tree orders by subtraction, which does not keep
+         * the order of the words of an Alfa the clauses are sorted by
+         */
+        if (strategy == 2 and exprtype == AlfaType)
+            strategy = 1;
+        /* The labels with no gaps have always had a table */
+        if (strategy == 1 and exprtype->k == kindScalar and
+            valueSpan == clauseCnt)
+            strategy = 3;
+        if (strategy == 0) {
+            /* A table is taken when it is at least half full */
+            if (tableFits and (valueSpan == clauseCnt or
+                               (4 <= clauseCnt and valueSpan <= 2 * clauseCnt)))
+                strategy = 3;
+            else if (8 <= clauseCnt and exprtype != AlfaType)
+                strategy = 2;
+            else
+                strategy = 1;
+        }
+        if (strategy == 1) {
+            itemSpan = 34000;
+            P0715(0, l4var17z);
+            if (firstType->k == kindRange) {
+                itemSpan = std::max(std::abs(firstType->cast<RangeT>().left),
+                                    std::abs(firstType->cast<RangeT>().right));
+            } else {
+                if (firstType->k == kindScalar)
+                    itemSpan = firstType->cast<ScalarT>().numen;
+            }
+            itemsEnded = (itemSpan < 32000);
+            if (itemsEnded) {
+                form1Insn(KATI+14);
+            } else {
+                form1Insn(KATX+SP+1);
+            }
+            minValue.i = (minValue.i - minValue.i); /* WTF? */
+            while (allClauses != NULL) {
+                if (itemsEnded) {
+                    curVal.i = (minValue.i - allClauses->value.i);
+                    curVal.i = curVal.ii;
+                    form1Insn(getValueOrAllocSymtab(curVal.i) +
+                              (KUTM+I14));
+                    form1Insn(KVZM+I14 + allClauses->offset);
+                    minValue = allClauses->value;
+                } else {
+                    form1Insn(KXTA+SP+1);
+                    curVal = allClauses->value;
+                    form2Insn(KAEX + I8 + getFCSToffset(),
+                              InsnTemp[UZA] + allClauses->offset);
+                }
+                allClauses = allClauses->next;
+            }
+            if (otherSeen)
+                form1Insn(InsnTemp[UJ] + otherOffset);
+            goto L16211;
+        } else if (strategy == 2) {
+            P0715(0, l4var17z);
+            form1Insn(KATX+SP+1);
+            caseTree(allClauses, clauseCnt, otherOffset, endOfStmt);
+            goto L16211;
+        }
+        if (not otherSeen) {
+            otherOffset = moduleOffset;
+            formJump(endOfStmt);
+        }
+        P0715(0, l4var17z);
+        curVal = minValue;
+        P0715(-(InsnTemp[U1A]+otherOffset), maxValue.i);
+        curVal = minValue;
+        curVal.i = curVal.ii;
+        form1Insn(KATI+14);
+        curVal.i = ((moduleOffset + (1)) - curVal.i);
+        if (curVal.i < 040000) {
+            curVal.i = (curVal.i - 040000);
+            curVal.i = allocSymtab(041000000 | (curVal.ii & 077777));
+        }
+        form1Insn(KUJ+I14 + curVal.i);
+        /* The missing values go to OTHERWISE */
+        for (value = minValue.i; value <= maxValue.i; ++value) {
+            while (allClauses->value.i < value)
+                allClauses = allClauses->next;
+            padToLeft();
+            if (allClauses->value.i == value)
+                form1Insn(InsnTemp[UJ] + allClauses->offset);
+            else
+                form1Insn(InsnTemp[UJ] + otherOffset);
+        }
+L16211:
+        P0715(0, endOfStmt);
+        if (not goodMode)
+            disableNorm();
+        /* 16217 */
+    }
+} /* caseStatement */
+
+/* Whether the evaluation of an expression has no effects, so that
+ * its parts may be computed once in any order.
+ */
+bool pureExpr(ExprPtr e)
+{
+    switch (e->op) {
+    case GETVAR: case GETENUM: case NOOP: case op36: case op37:
+        return true;
+    case GETFIELD: case DEREF: case FILEPTR: case BOUNDS: case TOREAL:
+    case NOTOP: case INEGOP: case RNEGOP:
+        return pureExpr(e->expr1);
+    default:
+        if (e->op <= MKRANGE or e->op == ASSIGNOP or e->op == GETELT)
+            return pureExpr(e->expr1) and pureExpr(e->expr2);
+        return false;
+    }
+}
+
+bool sameExpr(ExprPtr a, ExprPtr b)
+{
+    if (a == b)
+        return true;
+    if (a->op != b->op)
+        return false;
+    switch (a->op) {
+    case GETVAR:
+        return a->id1 == b->id1;
+    case GETENUM:
+        return a->typ == b->typ and a->d1.ii == b->d1.ii;
+    case NOOP:
+        return a->val.ii == b->val.ii;
+    case op36: case op37:
+        return a->num1 == b->num1;
+    case GETFIELD:
+        return a->id2 == b->id2 and sameExpr(a->expr1, b->expr1);
+    case DEREF: case FILEPTR: case TOREAL: case NOTOP: case INEGOP: case RNEGOP:
+        return sameExpr(a->expr1, b->expr1);
+    case BOUNDS:
+        return a->typ2 == b->typ2 and sameExpr(a->expr1, b->expr1);
+    default:
+        return (a->op <= MKRANGE or a->op == GETELT) and
+            sameExpr(a->expr1, b->expr1) and sameExpr(a->expr2, b->expr2);
+    }
+}
+
+/* The operators in an expression, as an estimate of its code */
+int64_t insnsOf(ExprPtr e)
+{
+    switch (e->op) {
+    case GETVAR: case GETENUM: case NOOP: case op36: case op37:
+        return 0;
+    case GETFIELD: case DEREF: case FILEPTR: case BOUNDS: case TOREAL:
+    case NOTOP: case INEGOP: case RNEGOP:
+        return 1 + insnsOf(e->expr1);
+    default:
+        return 1 + insnsOf(e->expr1) + insnsOf(e->expr2);
+    }
+}
+
+/* The instructions needed to form the address of a variable,
+ * roughly; -1 if it cannot be kept in an index register.
+ */
+int64_t addrWork(ExprPtr e)
+{
+    std::vector<int64_t> uses;
+    int64_t work, lo, hi;
+
+    switch (e->op) {
+    case GETVAR:
+        return 0;
+    case GETFIELD:
+        if (e->id2->pckfield())
+            return -1;
+        return addrWork(e->expr1);
+    case DEREF:
+        work = addrWork(e->expr1);
+        if (work < 0)
+            return -1;
+        return work + (checkBounds and not optSflags.m.has(NoPtrCheck) ? 4 : 1);
+    case GETELT: {
+        work = addrWork(e->expr1);
+        if (work < 0)
+            return -1;
+        ArrayT & array = e->expr1->typ->cast<ArrayT>();
+        if (array.pck and array.pcksize < 48)
+            return -1;
+        if (e->expr2->op == GETENUM)
+            return work;
+        work = work + 1 + insnsOf(e->expr2);
+        if (array.base->size != 1)
+            work = work + 2;
+        if (checkBounds and
+            not (valueRange(e->expr2, lo, hi, uses) and
+                 array.range->left <= lo and hi <= array.range->right))
+            work = work + 3;
+        return work;
+    }
+    default:
+        return -1;
+    }
+}
+
+/* The uses of a pattern in an expression that are always evaluated:
+ * not those in the operands of AND and OR, which may be skipped.
+ */
+int64_t countSame(ExprPtr e, ExprPtr pattern)
+{
+    if (sameExpr(e, pattern))
+        return 1;
+    switch (e->op) {
+    case GETVAR: case GETENUM: case NOOP: case op36: case op37:
+    case AMPERS: case OROP:
+        return 0;
+    case GETFIELD: case DEREF: case FILEPTR: case BOUNDS: case TOREAL:
+    case NOTOP: case INEGOP: case RNEGOP:
+        return countSame(e->expr1, pattern);
+    default:
+        return countSame(e->expr1, pattern) + countSame(e->expr2, pattern);
+    }
+}
+
+void replaceSame(ExprPtr & e, ExprPtr pattern, ExprPtr by)
+{
+    if (sameExpr(e, pattern)) {
+        e = by;
+        return;
+    }
+    switch (e->op) {
+    case GETVAR: case GETENUM: case NOOP: case op36: case op37:
+        break;
+    case GETFIELD: case DEREF: case FILEPTR: case BOUNDS: case TOREAL:
+    case NOTOP: case INEGOP: case RNEGOP:
+        replaceSame(e->expr1, pattern, by);
+        break;
+    default:
+        replaceSame(e->expr1, pattern, by);
+        replaceSame(e->expr2, pattern, by);
+    }
+}
+
+/* With hoistLoops, the addresses of the array elements and pointed-to
+ * variables that a statement uses more than once are formed once,
+ * before it, in the index registers free of with statements; the uses
+ * refer to the registers as the fields of a with record do. Only the uses
+ * always evaluated are counted, lest the checks of forming an address
+ * precede the operand of AND or OR guarding it.
+ * Returns the registers taken, to be released after the statement.
+ */
+Bitset shareAddresses(ExprPtr & root, ExprPtr e)
+{
+    Bitset taken = Bits();
+    ExprPtr shared;
+    int64_t work, count, reg;
+
+    switch (e->op) {
+    case GETVAR: case GETENUM: case NOOP: case op36: case op37:
+    case AMPERS: case OROP:
+        return taken;
+    case GETELT: case DEREF:
+        work = addrWork(e);
+        if (work > 0) {
+            count = countSame(root, e);
+            if (count > 1 and (count - 1) * work > 2 and
+                set148z * set147z != Bits()) {
+                reg = minel(set148z * set147z);
+                curExpr = e;
+                curVal.i = reg;
+                (void) formOperator(ADDRTOREG);
+                shared = new Expr;
+                shared->op = NOOP;
+                shared->val.ii = 0;
+                shared->val.i = reg;
+                shared->expr2 = e;
+                taken = Bits(reg);
+                set147z = set147z - taken;
+                set146z = set146z + taken;
+                replaceSame(root, e, shared);
+                return taken;
+            }
+        }
+        break;
+    default:
+        break;
+    }
+    switch (e->op) {
+    case GETFIELD: case DEREF: case FILEPTR: case BOUNDS: case TOREAL:
+    case NOTOP: case INEGOP: case RNEGOP:
+        return shareAddresses(root, e->expr1);
+    default:
+        taken = shareAddresses(root, e->expr1);
+        return taken + shareAddresses(root, e->expr2);
+    }
+}
+
+bool isParam(IdentRecPtr routine, IdentRecPtr id)
+{
+    IdentRecPtr param = routine->argList();
+
+    if (param == NULL)
+        return false;
+    while (param != routine) {
+        if (param == id)
+            return true;
+        param = param->list();
+    }
+    return false;
+}
+
+/* Whether a part of a routine body refers to nothing of the routine's
+ * own but its parameters, and to nothing allocated after mark,
+ * which goes away with the routine's scope.
+ */
+bool inlinable(ExprPtr e, IdentRecPtr routine, void * mark)
+{
+    switch (e->op) {
+    case GETENUM:
+        return (void*) e->typ < mark;
+    case GETVAR:
+        if (e->id1->cl == ROUTINEID)
+            return false;
+        if (e->id1->offset == curFrameRegTemplate)
+            return isParam(routine, e->id1) and
+                (e->id1->cl == FORMALID or e->id1->typ->size == 1);
+        return (void*) e->id1 < mark;
+    case BOUNDS:
+        if ((void*) e->typ2 >= mark)
+            return false;
+        return inlinable(e->expr1, routine, mark);
+    case GETFIELD:
+        if ((void*) e->id2 >= mark)
+            return false;
+        return inlinable(e->expr1, routine, mark);
+    case DEREF: case FILEPTR: case TOREAL: case NOTOP: case INEGOP: case RNEGOP:
+    case STANDPROC:
+        return (void*) e->typ < mark and inlinable(e->expr1, routine, mark);
+    default:
+        if (e->op <= MKRANGE or e->op == ASSIGNOP or e->op == GETELT)
+            return (void*) e->typ < mark and
+                inlinable(e->expr1, routine, mark) and
+                inlinable(e->expr2, routine, mark);
+        return false;
+    }
+}
+
+/* A procedure body may assign through its var parameters only,
+ * nothing declared outside the routine
+ */
+bool inlineTarget(ExprPtr e)
+{
+    switch (e->op) {
+    case GETVAR:
+        return e->id1->offset == curFrameRegTemplate and e->id1->cl == FORMALID;
+    case GETELT: case GETFIELD:
+        return inlineTarget(e->expr1);
+    default:
+        return false;
+    }
+}
+
+int64_t usesOf(ExprPtr e, IdentRecPtr param)
+{
+    switch (e->op) {
+    case GETVAR:
+        return e->id1 == param;
+    case GETENUM: case NOOP: case op36: case op37:
+        return 0;
+    case GETFIELD: case DEREF: case FILEPTR: case BOUNDS: case TOREAL:
+    case NOTOP: case INEGOP: case RNEGOP: case STANDPROC:
+        return usesOf(e->expr1, param);
+    default:
+        return usesOf(e->expr1, param) + usesOf(e->expr2, param);
+    }
+}
+
+typedef std::vector<std::pair<IdentRecPtr, ExprPtr>> Actuals;
+
+/* Copies an inline body, out of the heap if keep, with its parameters
+ * replaced by the actual arguments.
+ */
+ExprPtr copyBody(ExprPtr e, const Actuals & actuals, bool keep)
+{
+    ExprPtr copy;
+
+    if (e->op == GETVAR) {
+        for (auto & actual : actuals) {
+            if (actual.first == e->id1) {
+                if (actual.second->op != GETVAR and actual.second->op != GETENUM)
+                    return actual.second;
+                e = actual.second;
+                break;
+            }
+        }
+    }
+    if (keep) {
+        inlineNodes.push_back(*e);
+        copy = &inlineNodes.back();
+    } else
+        copy = new Expr(*e);
+    switch (e->op) {
+    case GETVAR: case GETENUM: case NOOP: case op36: case op37:
+        break;
+    case GETFIELD: case DEREF: case FILEPTR: case BOUNDS: case TOREAL:
+    case NOTOP: case INEGOP: case RNEGOP: case STANDPROC:
+        copy->expr1 = copyBody(e->expr1, actuals, keep);
+        break;
+    default:
+        copy->expr1 = copyBody(e->expr1, actuals, keep);
+        copy->expr2 = copyBody(e->expr2, actuals, keep);
+    }
+    return copy;
+}
+
+/* Keeps the assignment making up the body of the routine being
+ * compiled, if it may be expanded inline; defineRoutine decides
+ * when the body is over.
+ */
+void noteInlineBody(ExprPtr assn)
+{
+    IdentRecPtr routine = programme::super.back()->l2idr2z;
+    ExprPtr body;
+    void * mark;
+
+    if (inlineLimit == 0 or errors or curProcNesting == 1 or
+        assn == NULL or assn->op != ASSIGNOP)
+        return;
+    mark = programme::super[programme::super.size() - 2]->scopeBound;
+    if (routine->typ != NULL) {
+        if (assn->expr1->op != GETVAR or assn->expr1->id1 != routine)
+            return;
+        body = assn->expr2;
+        if (body->typ != routine->typ and
+            (body->op != BOUNDS or body->typ2 != routine->typ))
+            return;
+    } else {
+        if (not inlineTarget(assn->expr1))
+            return;
+        body = assn;
+    }
+    if (inlinable(body, routine, mark))
+        inlineCand = copyBody(body, Actuals(), true);
+}
+
+/* The routines declared in a scope being closed are gone */
+void forgetInlines(void * mark)
+{
+    inlineBodies.erase(std::remove_if(inlineBodies.begin(), inlineBodies.end(),
+                                      [mark](const InlineBody & b) {
+                                          return (void*) b.routine >= mark;
+                                      }),
+                       inlineBodies.end());
+}
+
+/* Replaces a call by the body of the routine, if it is kept and
+ * the arguments can stand for the parameters: a value argument
+ * used more than once must be a variable or a constant.
+ */
+bool expandCall(ExprPtr & call, int64_t line)
+{
+    IdentRecPtr routine = call->id2, param;
+    ExprPtr body = NULL, args, arg;
+    Actuals actuals;
+
+    if (errors or optSflags.m.has(DebugEntry))
+        return false;
+    for (auto & b : inlineBodies)
+        if (b.routine == routine)
+            body = b.body;
+    if (body == NULL)
+        return false;
+    param = routine->argList();
+    for (args = call->expr1; args != NULL; args = args->expr1) {
+        if (args->expr2->op == ALNUM and args->expr2->expr1 == NULL)
+            (void) expandCall(args->expr2, line);
+        arg = args->expr2;
+        if (param == NULL or param == routine or not pureExpr(arg))
+            return false;
+        if (param->cl == VARID) {
+            if ((arg->typ == RealType) != (param->typ == RealType))
+                return false;
+        } else if (param->cl != FORMALID or not lvalOpSet.has(arg->op))
+            return false;
+        if (usesOf(body, param) > 1 and arg->op != GETVAR and arg->op != GETENUM)
+            return false;
+        actuals.push_back(std::make_pair(param, arg));
+        param = param->list();
+    }
+    if (param != NULL and param != routine)
+        return false;
+    call = copyBody(body, actuals, false);
+    if (routine->typ == NULL)
+        noteAssigned(call->expr1);
+    inlinedHere.push_back(std::make_pair(routine, line));
+    return true;
+}
+
+/* A call, expanded in place when it can be; then it neither clobbers
+ * the registers of with statements nor makes the caller a non-leaf.
+ */
+void parseCall(IdentRecPtr routine)
+{
+    Bitset withRegs = set146z;
+    bool calls = bool48z;
+    int64_t line = lineCnt;
+
+    parseCallArgs(routine);
+    if (expandCall(curExpr, line)) {
+        set146z = withRegs;
+        bool48z = calls;
+    }
+}
+
+/* Whether a value stays the same while the innermost loop runs:
+ * it is made of constants and of the local variables the loop
+ * does not assign, which nothing else may change.
+ */
+bool loopInvariant(ExprPtr e)
+{
+    LoopHoist & loop = loopHoists.back();
+
+    switch (e->op) {
+    case GETENUM:
+        return true;
+    case GETVAR:
+        return e->id1->cl == VARID and
+            e->id1->offset == curFrameRegTemplate and
+            e->id1->value() < 074000 and e->typ->size == 1 and
+            std::find(loop.assigned.begin(), loop.assigned.end(),
+                      e->id1->id) == loop.assigned.end();
+    case INEGOP:
+        return loopInvariant(e->expr1);
+    default:
+        return e->op <= MKRANGE and
+            loopInvariant(e->expr1) and loopInvariant(e->expr2);
+    }
+}
+
+/* Whether the address of a variable stays the same while the innermost
+ * loop runs, and it can be formed before the loop with no check to fail.
+ */
+bool invariantAddress(ExprPtr e)
+{
+    std::vector<int64_t> uses;
+    int64_t lo, hi;
+
+    switch (e->op) {
+    case GETVAR:
+        return true;
+    case GETFIELD:
+        return invariantAddress(e->expr1);
+    case DEREF:
+        return not (checkBounds and not optSflags.m.has(NoPtrCheck)) and
+            e->expr1->op == GETVAR and loopInvariant(e->expr1);
+    case GETELT: {
+        if (not invariantAddress(e->expr1) or not loopInvariant(e->expr2))
+            return false;
+        ArrayT & array = e->expr1->typ->cast<ArrayT>();
+        return not checkBounds or
+             (valueRange(e->expr2, lo, hi, uses) and
+              array.range->left <= lo and hi <= array.range->right);
+    }
+    default:
+        return false;
+    }
+}
+
+/* The addresses of a statement that stay the same while the innermost
+ * loop runs are formed on the way into it, in the index registers free
+ * of with statements; the uses refer to the registers as shareAddresses
+ * makes them do.
+ */
+void hoistAddresses(ExprPtr & root, ExprPtr e)
+{
+    LoopHoist & loop = loopHoists.back();
+    ExprPtr held;
+    int64_t reg = 0;
+
+    switch (e->op) {
+    case GETVAR: case GETENUM: case NOOP: case op36: case op37:
+        return;
+    case GETELT: case DEREF:
+        if (addrWork(e) > 0 and invariantAddress(e)) {
+            for (auto & addr : loop.addrs)
+                if (sameExpr(addr.first, e))
+                    reg = addr.second;
+            if (reg == 0 and set148z * set147z != Bits()) {
+                reg = minel(set148z * set147z);
+                loop.addrs.push_back(std::make_pair(copyBody(e, Actuals(), true), reg));
+                loop.regs = loop.regs + Bits(reg);
+                set147z = set147z - Bits(reg);
+                set146z = set146z + Bits(reg);
+                regsUsed = regsUsed - Bits(reg);
+            }
+            if (reg != 0) {
+                held = new Expr;
+                held->op = NOOP;
+                held->val.ii = 0;
+                held->val.i = reg;
+                held->expr2 = e;
+                replaceSame(root, e, held);
+                return;
+            }
         }
-L16211:
-        P0715(0, endOfStmt);
-        if (not goodMode)
-            disableNorm();
-        /* 16217 */
+        break;
+    default:
+        break;
     }
-} /* caseStatement */
+    switch (e->op) {
+    case GETFIELD: case DEREF: case FILEPTR: case BOUNDS: case TOREAL:
+    case NOTOP: case INEGOP: case RNEGOP:
+        hoistAddresses(root, e->expr1);
+        break;
+    default:
+        hoistAddresses(root, e->expr1);
+        hoistAddresses(root, e->expr2);
+    }
+}
 
 void assignStatement(bool doLHS)
 {
@@ -6876,9 +8814,10 @@ void assignStatement(bool doLHS)
     TypesPtr srcType, targType;
     bool &l3bool5z = Statement::super.back()->l3bool5z;
 
-    if (doLHS)
+    if (doLHS) {
         parseLval();
-    else {
+        noteAssigned(curExpr);
+    } else {
         curExpr = new Expr;
         curExpr->typ = hashTravPtr->typ;
         curExpr->op = GETVAR;
@@ -7125,6 +9064,7 @@ struct standProc {
         if (hashTravPtr != NULL and
             hashTravPtr->cl >= VARID) {
             parseLval();
+            noteAssigned(curExpr);
             if (l5arg1z != NULL and
                 not typeCheck(l5arg1z, curExpr->typ))
                 error(errNeedOtherTypesOfOperands);
@@ -7141,6 +9081,7 @@ struct standProc {
         if (not l5arg1z) {
             if (not lvalOpSet.has(curExpr->op))
                 error(27); /* errExpressionWhereVariableExpected */
+            noteAssigned(curExpr);
         }
         if (l4exp9z == NULL) {
             if (l4typ3z && l4typ3z->k == kindFile) {
@@ -7443,6 +9384,7 @@ L17362:
                     throw 8888;
             }
             parseLval();
+            noteAssigned(curExpr);
             arg1Type = curExpr->typ;
             curVarKind = arg1Type->k;
         }
@@ -7695,6 +9637,8 @@ Statement::Statement()
 
     super.push_back(this);
     setup(boundary);
+    sharedRegs = Bits();
+    stmtCount = stmtCount + 1;
     bool110z = false;
     startLine = lineCnt;
     if (set147z.val == halfWord)
@@ -7717,6 +9661,7 @@ Statement::Statement()
                     } else {
                         l3var2z->line = lineCnt;
                         l3var2z->defined = true;
+                        labelsSeen = labelsSeen + 1;
                         padToLeft();
                         if (l3var2z->offset == 0) {
                             /* empty */
@@ -7751,6 +9696,16 @@ Statement::Statement()
                 l3var6z = hashTravPtr->cl;
                 if (l3var6z >= VARID) {
                     assignStatement(true);
+                    if (super.size() == 2)
+                        noteInlineBody(curExpr);
+                    if (not errors and curExpr != NULL and pureExpr(curExpr)) {
+                        l4exp1z = curExpr;
+                        if (not loopHoists.empty() and loopHoists.back().open)
+                            hoistAddresses(l4exp1z, l4exp1z);
+                        if (hoistLoops)
+                            sharedRegs = shareAddresses(l4exp1z, l4exp1z);
+                        curExpr = l4exp1z;
+                    }
                 } else {
                     if (l3var6z == ROUTINEID) {
                         if (hashTravPtr->typ == NULL) {
@@ -7760,9 +9715,11 @@ Statement::Statement()
                                 standProc();
                                 goto exit_ident;
                             }
-                            parseCallArgs(l3idr12z);
+                            parseCall(l3idr12z);
                         } else {
                             assignStatement(false);
+                            if (super.size() == 2)
+                                noteInlineBody(curExpr);
                         }
                     } else {
                         error(32); /* errWrongStartOfOperator */
@@ -7770,7 +9727,11 @@ Statement::Statement()
                     }
                 }
                 (void) formOperator(APPLYEXPR);
+                set147z = set147z + sharedRegs;
+                set146z = set146z - sharedRegs;
                 } catch (int foo) {
+                    set147z = set147z + sharedRegs;
+                    set146z = set146z - sharedRegs;
                     if (foo != 8888) throw;
                 }
             else {
@@ -7779,7 +9740,7 @@ L8888:
                 skip(skipToSet + statEndSys);
             }
         } else if (SY == LPAREN) {
-            set146z = Bits();
+            set146z = hoistedRegs();
             inSymbol();
             if (SY != IDENT) {
                 error(errNoIdent);
@@ -7793,6 +9754,7 @@ L8888:
             l3var3z->offset = moduleOffset;
             l3var3z->exitTarget = 0;
             strLabList = l3var3z;
+            labelsSeen = labelsSeen + 1;
             inSymbol();
             checkSymAndRead(RPAREN);
             Statement();
@@ -7874,28 +9836,36 @@ L8888:
                 P0715(0, l3var10z);
             }
         } else if (SY == WHILESY) {
-            set146z = Bits();
+            set146z = hoistedRegs();
             disableNorm();
+            openLoop(0, true);
             padToLeft();
             l3var8z.i = moduleOffset;
+            condLoopDepth = condLoopDepth + 1;
             ifWhileStatement(DOSY);
+            condLoopDepth = condLoopDepth - 1;
             disableNorm();
             form1Insn(InsnTemp[UJ] + l3var8z.i);
+            closeLoop(l3var8z.i);
             P0715(0, l3var10z);
             arithMode = 1;
         } else if (SY == REPEATSY) {
-            set146z = Bits();
+            set146z = hoistedRegs();
             disableNorm();
+            openLoop(1, true);
             padToLeft();
             l3var7z.i = moduleOffset;
+            condLoopDepth = condLoopDepth + 1;
             do {
                 inSymbol();
                 Statement();
             } while (SY == SEMICOLON);
+            condLoopDepth = condLoopDepth - 1;
             if (SY != UNTILSY) {
                 requiredSymErr(UNTILSY);
                 stmtName = "REPEAT";
                 reportStmtType(startLine);
+                closeLoop(0);
                 goto L8888;
             }
             disableNorm();
@@ -7906,8 +9876,9 @@ L8888:
                 jumpTarget = l3var7z.i;
                 (void) formOperator(CONDJUMP);
             }
+            closeLoop(l3var7z.i);
         } else if (SY == FORSY) {
-            set146z = Bits();
+            set146z = hoistedRegs();
             forStatement();
         } else if (SY == SELECTSY) {
             disableNorm();
@@ -7941,6 +9912,7 @@ L8888:
         } else if (SY == WITHSY) {
             withStatement();
         } exit_ident:; /* 20757 */
+        resyncInductionVars();
         if (l3var4z.ii)
             lineNesting = lineNesting - 1;
         rollup(boundary);
@@ -7952,12 +9924,76 @@ L8888:
     /* 20766 */
 } /* Statement */
 
+/* A jump whose target is a plain UJ is sent to where the UJ goes.
+ * Only the jumps with the address taken as is are considered:
+ * UJ, UZA, U1A without an index register, and VZM, V1M, VLM.
+ */
+bool isThreadable(int64_t half)
+{
+    int64_t op;
+    if (not (half & 02000000))
+        return false;
+    op = (half >> 15) & 037;
+    if (op == 034 or op == 035 or op == 037)
+        return true;
+    return (op == 026 or op == 027 or op == 030) and (half >> 20) == 0;
+}
+
+/* The code is not moved, as the routine's labels and line tables are
+ * already final; the jumps only get their addresses replaced.
+ * The first word of objBuffer is at moduleOffset - count.
+ * Dropping the code after an unconditional jump or the loads made
+ * redundant would need the code to be relocatable.
+ * The -l2 listing has shown the code as generated; the jumps changed
+ * are noted after it, by the address of their word.
+ */
+void threadJumps(int64_t count)
+{
+    int64_t base, idx, half, prev, target, next, hops;
+    int pos;
+
+    base = moduleOffset - count;
+    prev = 0;
+    for (idx = 1; idx <= count; ++idx) {
+        for (pos = 24; pos >= 0; pos -= 24) {
+            half = (objBuffer[idx] >> pos) & 077777777;
+            /* A modified address is not the jump target */
+            if (isThreadable(half) and not (
+                (prev & 02000000) and
+                (((prev >> 15) & 037) == 022 or ((prev >> 15) & 037) == 023))) {
+                target = half & 077777;
+                for (hops = 0; hops < 16; ++hops) {
+                    if (target < base or target >= base + count)
+                        break;
+                    next = objBuffer[target - base + 1] >> 24;
+                    /* Not to copy a fixup chain link */
+                    if ((next & ~077777) != KUJ or (next & 077777) == target
+                        or (next & 077777) < 040000)
+                        break;
+                    target = next & 077777;
+                }
+                if (target != (half & 077777)) {
+                    objBuffer[idx] += (target - (half & 077777)) << pos;
+                    if (PASINFOR.listMode == 2)
+                        fprintf(listing, "      thread at %05lo: %05lo to %05lo\n",
+                                base + idx - 1 + PASINFOR.startOffset,
+                                half & 077777, target);
+                }
+            }
+            prev = half;
+        }
+    }
+}
+
 void outputObjFile()
 {
     int64_t idx;
+    PhaseTimer timer(stats.codegen);
 
     padToLeft();
     objBufIdx = objBufIdx - 1;
+    if (threadCode and not errors)
+        threadJumps(objBufIdx);
     for (idx = 1; idx <= objBufIdx; ++idx)
         CHILD.push_back(objBuffer[idx]);
     lineStartOffset = moduleOffset;
@@ -8022,6 +10058,8 @@ void defineRoutine()
     if (checkBounds or not optSflags.m.has(NoStackCheck))
         P0715(-1, 95); /* P/SC */
     l3var2z.i = lineNesting;
+    inlineCand = NULL;
+    stmtCount = 0;
     do {
         Statement();
         if (SY == SEMICOLON) {
@@ -8083,18 +10121,17 @@ void defineRoutine()
             objBuffer[savedObjIdx] |= l3var7z.ii | int64_t(KUTM+SP) << 24;
         }
     } /* 21261 */
+    if (inlineCand != NULL and stmtCount == 2 and not errors and
+        moduleOffset - l3var1z <= inlineLimit)
+        inlineBodies.push_back(InlineBody{l2idr2z, inlineCand});
     outputObjFile();
 } /* defineRoutine */
 
-struct initScalars {
-    int64_t adorned;
-    int64_t noProgram, l3var3z, l3var4z;
-    int64_t l3var5z, l3var6z;
-    IdentRecPtr l3var7z;
-    int64_t l3var8z, l3var9z;
+// The standard types and identifiers; they do not depend on the source.
+struct initPredefined {
+    IdentRecPtr curIdRec;
     TypesPtr temptype;
-    Word l3var11z;
-    IdentRecPtr &curIdRec;
+    int64_t l3var9z;
 
     void regSysType(int64_t l4arg1z, TypesPtr l4arg2z) {
         curIdRec = new IdentRec;
@@ -8130,12 +10167,12 @@ struct initScalars {
         addToHashTab(curIdRec);
     } /* registerSysProc */
 
-    initScalars();
+    initPredefined();
 };
 
-initScalars::initScalars() :
-    curIdRec(programme::super.back()->curIdRec)
+initPredefined::initPredefined()
 {
+    IdentRecPtr trueRec;
     BooleanType = new ScalarT(1);
     BooleanType->numen = 2;
     BooleanType->start = 0;
@@ -8175,9 +10212,9 @@ initScalars::initScalars() :
     regSysType(toText("TEXT"), textType);
     temptype = BooleanType;
     regSysEnum(toText("TRUE"), 1);
-    hashTravPtr = curIdRec;
+    trueRec = curIdRec;
     regSysEnum(toText("FALSE"), 0);
-    curIdRec->list() = hashTravPtr;
+    curIdRec->list() = trueRec;
     BooleanType->enums = curIdRec;
     maxSmallString = 0;
     for (strLen = 2; strLen <= 5; ++strLen)
@@ -8206,8 +10243,8 @@ initScalars::initScalars() :
 
     temptype = NULL;
     l3var9z = 0;
-    for (l3var5z = 0; l3var5z <= 28; ++l3var5z)
-        regSysProc(systemProcNames[l3var5z]);
+    for (int i = 0; i <= 28; ++i)
+        regSysProc(systemProcNames[i]);
     l3var9z = 0;
     temptype = RealType;
 
@@ -8242,6 +10279,22 @@ initScalars::initScalars() :
     regSysProc(toText("MINEL"));
     temptype = pointerType;
     regSysProc(toText("PTR"));
+} /* initPredefined */
+
+struct initScalars {
+    int64_t adorned;
+    int64_t noProgram, l3var3z, l3var4z;
+    int64_t l3var5z, l3var6z;
+    IdentRecPtr l3var7z;
+    int64_t l3var8z;
+    TypesPtr temptype;
+    Word l3var11z;
+
+    initScalars();
+};
+
+initScalars::initScalars()
+{
     l3var11z.ii = 047000000 + 30;
     programObj = new IdentRec;
     programObj->cl = ROUTINEID;
@@ -8446,11 +10499,10 @@ void parseParameters()
                 l3var1z->id = curIdent;
                 l3var1z->offset = curFrameRegTemplate;
                 l3var1z->cl = parClass;
-                l3var1z->next = symHashTabBase[bucket];
                 l3var1z->typ = NULL;
                 l3var1z->list() = curIdRec;
                 l3var1z->value() = l2int18z;
-                symHashTabBase[bucket] = l3var1z;
+                linkIdent(symHashTabBase[bucket], l3var1z);
                 l2int18z = l2int18z + 1;
                 if (l3var2z == NULL)
                     curIdRec->argList() = l3var1z;
@@ -8514,18 +10566,48 @@ void parseParameters()
     checkSymAndRead (RPAREN);
 } /* parseParameters */
 
-void exitScope(IdentRecPtr arg[128])
+// Counts the hash chain lengths of a table holding the most identifiers yet.
+void countChains(IdentRecPtr * table, int64_t & peak, int64_t * hist)
+{
+    int64_t len[HASH_SIZE], total = 0;
+    IdentRecPtr id;
+    int i;
+
+    for (i = 0; i < HASH_SIZE; ++i) {
+        len[i] = 0;
+        for (id = table[i]; id != NULL; id = id->next)
+            ++len[i];
+        total += len[i];
+    }
+    if (total < peak)
+        return;
+    peak = total;
+    std::fill(hist, hist + CHAIN_HIST, 0);
+    for (i = 0; i < HASH_SIZE; ++i)
+        ++hist[std::min(len[i], int64_t(CHAIN_HIST - 1))];
+}
+
+// Removes the identifiers of the scope just parsed from the chains
+// they were added to.
+void exitScope()
 {
     IdentRecPtr &workidr = programme::super.back()->workidr;
     IdentRecPtr &scopeBound = programme::super.back()->scopeBound;
+    int64_t &scopeMark = programme::super.back()->scopeMark;
 
-    for (int ii = 0; ii <= 127; ++ii) {
-        workidr = arg[ii];
+    if (showStats) {
+        countChains(symHashTabBase, stats.names, stats.nameChains);
+        countChains(typeHashTabBase, stats.types, stats.typeChains);
+    }
+    for (size_t ii = scopeMark; ii < scopeLog.size(); ++ii) {
+        IdentRecPtr & head = *scopeLog[ii];
+        workidr = head;
         while (workidr != NULL and
               workidr >= scopeBound)
             workidr = workidr->next;
-        arg[ii] = workidr;
+        head = workidr;
     }
+    scopeLog.resize(scopeMark);
 } /* exitScope */
 
 programme::programme(int64_t & l2arg1z, IdentRecPtr const l2idr2z_)
@@ -8586,8 +10668,8 @@ L22421:
                     error(errIdentAlreadyDefined);
                 // workidr@ := [curIdent, curFrameRegTemplate, symHashTabBase[bucket], , ENUMID, NULL];
                 workidr =
-                    new IdentRec(curIdent, curFrameRegTemplate, symHashTabBase[bucket], NULL, ENUMID, NULL, 0L);
-                symHashTabBase[bucket] = workidr;
+                    new IdentRec(curIdent, curFrameRegTemplate, NULL, NULL, ENUMID, NULL, 0L);
+                linkIdent(symHashTabBase[bucket], workidr);
                 inSymbol();
                 if (charClass != EQOP)
                     error(errBadSymbol);
@@ -8634,9 +10716,9 @@ L22421:
                         if (l2typ13z->k != kindPtr) {
                             prevErrPos = 0;
                             error(78); /* errPredefinedAsPointer */
-                            printf(": ");
+                            fprintf(listing, ": ");
                             printTextWord(l2var12z);
-                            printf(" in line %ld\n", curIdRec->offset);
+                            fprintf(listing, " in line %ld\n", curIdRec->offset);
                         }
                         l2typ14z->cast<PtrT>().pbase = l2typ13z->cast<PtrT>().pbase;
                     } else {
@@ -8651,8 +10733,7 @@ L22421:
                     curIdRec->typ = l2typ13z;
                     curIdRec->cl = TYPEID;
                 } /* 22574 */
-                curIdRec->next = symHashTabBase[ii];
-                symHashTabBase[ii] = curIdRec;
+                linkIdent(symHashTabBase[ii], curIdRec);
                 int93z = 0;
                 checkSymAndRead(SEMICOLON);
             } /* 22602 */
@@ -8661,9 +10742,9 @@ L22421:
                 curIdRec = typelist;
                 prevErrPos = 0;
                 error(79); /* errNotFullyDefined */
-                printf(": ");
+                fprintf(listing, ": ");
                 printTextWord(l2var12z);
-                printf(" in line %ld\n", curIdRec->offset);
+                fprintf(listing, " in line %ld\n", curIdRec->offset);
                 typelist = typelist->next;
             }
         } /* TYPESY -> 22612 */
@@ -8682,10 +10763,9 @@ L22421:
                         error(errIdentAlreadyDefined);
                     curIdRec->id = curIdent;
                     curIdRec->offset = curFrameRegTemplate;
-                    curIdRec->next = symHashTabBase[bucket];
                     curIdRec->cl = VARID;
                     curIdRec->list() = NULL;
-                    symHashTabBase[bucket] = curIdRec;
+                    linkIdent(symHashTabBase[bucket], curIdRec);
                     inSymbol();
                     if (workidr == NULL)
                         workidr = curIdRec;
@@ -8742,9 +10822,9 @@ L22421:
                 if (l2bool8z && workidr->value() == -1) {
                     workidr->value() = localSize;
                     if (PASINFOR.listMode == 3) {
-                        printf("%25s", "VARIABLE ");
+                        fprintf(listing, "%25s", "VARIABLE ");
                         printTextWord(workidr->id);
-                        printf(" OFFSET (%ld) %05loB. WORDS=%05loB\n", curProcNesting,
+                        fprintf(listing, " OFFSET (%ld) %05loB. WORDS=%05loB\n", curProcNesting,
                                 localSize, jj);
                     }
                     localSize = localSize + jj;
@@ -8783,7 +10863,7 @@ L22421:
             if (curExternFile->line == 0) {
                 error(80); /* errUndefinedExternFile */
                 printTextWord(curExternFile->id);
-                putchar('\n');
+                putc('\n', listing);
             }
             curExternFile = curExternFile->next;
         }
@@ -8819,9 +10899,8 @@ L22421:
             curIdRec = new IdentRec;
             curIdRec->id = curIdent;
             curIdRec->offset = curFrameRegTemplate;
-            curIdRec->next = symHashTabBase[bucket];
             curIdRec->typ = NULL;
-            symHashTabBase[bucket] = curIdRec;
+            linkIdent(symHashTabBase[bucket], curIdRec);
             curIdRec->cl = ROUTINEID;
             curIdRec->list() = NULL;
             curIdRec->value() = 0;
@@ -8900,6 +10979,7 @@ L22421:
             }
             curIdRec->flags() = curIdRec->flags() + curVal.m;
         } else /* 23257 */ {
+            scopeMark = scopeLog.size();
             do {
                 setup(scopeBound);
                 programme(l2int18z, curIdRec);
@@ -8907,8 +10987,8 @@ L22421:
                     errAndSkip(errBadSymbol, skipToSet);
             } while (SY != FUNCSY && SY != PROCSY && SY != BEGINSY);
             rollup(scopeBound);
-            exitScope(symHashTabBase);
-            exitScope(typeHashTabBase);
+            forgetInlines(scopeBound);
+            exitScope();
             goto L23301;
         } /* 23277 */
         inSymbol();
@@ -8935,12 +11015,12 @@ L23301:
             printTextWord(preDefHead->id);
             preDefHead = preDefHead->preDefLink();
         }
-        putchar('\n');
+        putc('\n', listing);
     }
     defineRoutine();
     while (numLabList != l2var16z) {
         if (not numLabList->defined) {
-            printf(" %ld:", int64_t(numLabList->id.i));
+            fprintf(listing, " %ld:", int64_t(numLabList->id.i));
             l2bool8z = false;
         }
         numLabList = numLabList->next;
@@ -9021,49 +11101,6 @@ struct initTables {
         }
     } /* initInsnTemplates */
 
-    void regResWord(int64_t l4arg1z) {
-        KeyWord * kw;
-        Word l4var2z;
-        curVal.ii = l4arg1z;
-        curVal.i = (curVal.m.val % 65535) % 128;
-        l4var2z.ii = l4arg1z;
-        kw = new KeyWord;
-        kw->w = l4var2z;
-        kw->sym = SY;
-        kw->op = charClass;
-        kw->next = KeyWordHashTabBase[curVal.i];
-        KeyWordHashTabBase[curVal.i] = kw;
-        if (charClass == NOOP) {
-            succ(SY);
-        } else {
-            succ(charClass);
-        }
-    } /* regResWord */
-
-    void regKeyWords() {
-        SY = MULOP;
-        charClass = AMPERS;
-        regResWord(toText("AND"));
-        regResWord(toText("DIV"));
-        regResWord(toText("MOD"));
-        SY = GTSY; /* reused as NILSY */
-        charClass = NOOP;
-        regResWord(toText("NIL"));
-        SY = ADDOP;
-        charClass = OROP;
-        regResWord(toText("OR"));
-        SY = RELOP;
-        charClass = INOP;
-        regResWord(toText("IN"));
-        SY = NOTSY;
-        charClass = NOOP;
-        regResWord(toText("NOT"));
-        SY = LABELSY;
-        charClass = NOOP;
-        for (idx = 0; idx <= 29; ++idx)
-            regResWord(resWordNameBase[idx]);
-    } /* regKeyWords */
-
     void initArrays() {
         // int64_t l3var1z;
         int64_t l3var2z;
@@ -9113,12 +11150,10 @@ struct initTables {
         CHILD.clear();
         for (jdx = 1; jdx <= 10; ++jdx)
             CHILD.push_back(0);
-        for (idx = 0; idx <= 127; ++idx) {
+        for (idx = 0; idx < HASH_SIZE; ++idx) {
             symHashTabBase[idx] = NULL;
             typeHashTabBase[idx] = NULL;
-            KeyWordHashTabBase[idx] = NULL;
         }
-        regKeyWords();
         numLabList = NULL;
         totalErrors = 0;
         heapCallsCnt = 0;
@@ -9133,10 +11168,11 @@ void finalize()
 {
     int64_t idx, cnt;
     int64_t sizes[11]; // array [1..10] of @Integer;
+    PhaseTimer timer(stats.finalize);
 
     sizes[1] = 1;
     sizes[2] = symTabPos - 074000 - 1;
-    sizes[5] = longSymCnt;
+    sizes[5] = longSyms.size();
     sizes[6] = moduleOffset - 040000;
     sizes[8] = FcstCnt;
     sizes[3] = 0;
@@ -9159,7 +11195,7 @@ void finalize()
     */
     CHILD.insert(CHILD.end(), FCST.begin(), FCST.end());
     curVal.i = (symTabPos - 070000L) * 0100000000L;
-    for (cnt = 1; cnt <= longSymCnt; ++cnt) {
+    for (cnt = 0; cnt < int64_t(longSyms.size()); ++cnt) {
         idx = longSymTabBase[cnt];
         symTab[idx] |= curVal.ii & leftAddr;
         curVal.i = (curVal.i + 0100000000L);
@@ -9167,13 +11203,13 @@ void finalize()
     symTabPos = symTabPos - 1;
     for (cnt = 074000; cnt <= symTabPos; ++cnt)
         CHILD.push_back(symTab[cnt]);
-    for (cnt = 1; cnt <= longSymCnt; ++cnt)
+    for (cnt = 0; cnt < int64_t(longSyms.size()); ++cnt)
         CHILD.push_back(longSyms[cnt]);
     if (allowCompat) {
-        printf("%6ld LINES STRUCTURE ", lineCnt - 1);
+        fprintf(listing, "%6ld LINES STRUCTURE ", lineCnt - 1);
         for (idx=1; idx <=10; ++idx)
-            printf("%ld ", sizes[idx]);
-        putchar('\n');
+            fprintf(listing, "%ld ", sizes[idx]);
+        putc('\n', listing);
     }
     entryPtTable[entryPtCnt] = 0;
 
@@ -9184,6 +11220,7 @@ void usage ()
     printf("%s\n", boilerplate);
     printf("Usage:\n");
     printf("    %s [option...] infile [outfile]\n", progname);
+    printf("    %s -B listfile [-jN] [-T]\n", progname);
     printf("Options:\n");
     printf("    -a0 -a1 -a2         Output encoding for strings:\n");
     printf("                        -a0: UTF-8\n");
@@ -9198,6 +11235,10 @@ void usage ()
     printf("                        -d8: Invoke Pascal Debugger\n");
     printf("    -e- -e+             Make procedures external (-e+) or local (-e-)\n");
     printf("    -f- -f+             Compile procedures as Pascal (-f-) or Fortran (-f+)\n");
+    printf("    -g+ -g-             Send jumps to unconditional jumps on to where these\n");
+    printf("                        go; -l2 notes them after the routine (default -g+)\n");
+    printf("    -i0 -i1 ... -i63    Expand calls of routines of up to N words in place\n");
+    printf("                        (default -i0, disabled)\n");
     printf("    -k0 -k1 ... -k23    Heap size in 1024-word chunks (default -k4)\n");
     printf("    -l0 -l1 -l2 -l3     Listing mode:\n");
     printf("                        -l0: No listing, only error messages\n");
@@ -9205,6 +11246,15 @@ void usage ()
     printf("                        -l2: Also print generated object code\n");
     printf("                        -l3: Also print offsets for variables and fields\n");
     printf("    -m+ -m-             Optimize integer multiplication (positives only)\n");
+    printf("    -n0 -n1 -n2 -n3     Code for case statements:\n");
+    printf("                        -n0: Chosen by the labels\n");
+    printf("                        -n1: Compare chain, or a jump table for labels\n");
+    printf("                        with no gaps (default)\n");
+    printf("                        -n2: Binary decision tree\n");
+    printf("                        -n3: Jump table, if the labels allow\n");
+    printf("    -o- -o+             Keep loop-invariant addresses, the counts of for\n");
+    printf("                        loops and the addresses used more than once by an\n");
+    printf("                        assignment in index registers (default -o-)\n");
     printf("    -p+ -p-             Enable/disable debug information and crash dump\n");
     printf("    -r+ -r-             Compare reals with predefined tolerance\n");
     printf("    -s0                 Use stars for commons (like *foobar*)\n");
@@ -9219,13 +11269,29 @@ void usage ()
     printf("    -s9                 Unknown\n");
     printf("    -t+ -t-             Enable/disable range checks\n");
     printf("    -u- -u+             Set length of source lines: 120 or 72 columns\n");
+    printf("    -x- -x+             Multiply and divide by constants with additions and\n");
+    printf("                        the exponent, keep the index products of for loops\n");
+    printf("                        in temporaries (default -x-)\n");
     printf("    -y- -y+             Disable/enable non-standard syntax\n");
+    printf("    -S file             Load the initial state from the file, if it is made\n");
+    printf("                        by this build; otherwise save it there\n");
+    printf("    -T                  Report the time taken by the phases of the compilation\n");
+    printf("                        and the use of the tables, after the listing\n");
+    printf("    -V                  Trace the expressions compiled to stderr; twice (-VV),\n");
+    printf("                        also the symbol table entries\n");
     printf("    -v                  Output version information and exit\n");
+    printf("    -B listfile         Compile the units listed in the file, one per line,\n");
+    printf("                        each given as [option...] infile [outfile]\n");
+    printf("    -jN                 With -B, compile N units at a time\n");
+    printf("    -T                  With -B, follow the listing of each unit by its\n");
+    printf("                        number, status and the time taken\n");
     printf("    -h                  Display this help and exit\n");
-    exit(0);
 }
 
-void initOptions(int argc, char **argv)
+// Sets the options and opens the source. Returns false if the unit is
+// not to be compiled, after an error, the help or the version, with
+// the exit status in status.
+bool initOptions(int argc, char **argv, int & status)
 {
     PASINFOR.startOffset -= 040000;
     commentModeCH = ' ';
@@ -9251,6 +11317,11 @@ void initOptions(int argc, char **argv)
     doPMD = true; // not (42 in curVal.m);
     checkTypes = true;
     fixMult = true;
+    inlineLimit = 0;
+    caseMode = 1;
+    hoistLoops = false;
+    reduceOps = false;
+    threadCode = true;
     fuzzReals = true;
     pseudoZ = true;
     checkBounds = true; // not (44 in curVal.m);
@@ -9260,30 +11331,29 @@ void initOptions(int argc, char **argv)
     fileBufSize = 1;
     charEncoding = 2;
     chain = NULL;
-    longSymCnt = 0;
     extSymAdornment = 0;
-    symTabCnt = 0;
 
     // Get base name of the program.
     progname = strrchr(argv[0], '/');
     progname = progname ? progname+1 : argv[0];
+    status = -1;
 
     for (;;) {
-        switch (getopt(argc, argv, "vVhe:p:t:c:r:m:y:u:f:a:d:k:b:s:l:")) {
+        switch (getopt(argc, argv, "vVThe:g:p:t:c:r:m:n:i:o:x:y:u:f:a:d:k:b:s:l:S:")) {
         case EOF:
             break;
         case 'a':
             charEncoding = strtoul(optarg, 0, 0);
             if (charEncoding > 2) {
                 fprintf(stderr, "%s: Bad option -a\n", progname);
-                exit(-1);
+                return false;
             }
             continue;
         case 'b':
             fileBufSize = strtoul(optarg, 0, 0);
             if (fileBufSize > 4) {
                 fprintf(stderr, "%s: Bad option -b\n", progname);
-                exit(-1);
+                return false;
             }
             continue;
         case 'c':
@@ -9293,7 +11363,7 @@ void initOptions(int argc, char **argv)
             curVal.i = strtoul(optarg, 0, 0);
             if (curVal.i > 15) {
                 fprintf(stderr, "%s: Bad option -d\n", progname);
-                exit(-1);
+                return false;
             }
             optSflags.m = optSflags.m * BitRange(0, 40) + curVal.m * BitRange(41, 47);
             continue;
@@ -9303,23 +11373,46 @@ void initOptions(int argc, char **argv)
         case 'f':
             checkFortran = (optarg[0] == '+');
             continue;
+        case 'g':
+            threadCode = (optarg[0] == '+');
+            continue;
+        case 'i':
+            inlineLimit = strtoul(optarg, 0, 0);
+            if (inlineLimit > 63) {
+                fprintf(stderr, "%s: Bad option -i\n", progname);
+                return false;
+            }
+            continue;
         case 'k':
             heapSize = strtoul(optarg, 0, 0);
             if (heapSize > 23) {
                 fprintf(stderr, "%s: Bad option -k\n", progname);
-                exit(-1);
+                return false;
             }
             continue;
         case 'l':
             PASINFOR.listMode = strtoul(optarg, 0, 0);
             if (PASINFOR.listMode > 3) {
                 fprintf(stderr, "%s: Bad option -l\n", progname);
-                exit(-1);
+                return false;
             }
             continue;
         case 'm':
             fixMult = (optarg[0] == '+');
             continue;
+        case 'n':
+            caseMode = strtoul(optarg, 0, 0);
+            if (caseMode > 3) {
+                fprintf(stderr, "%s: Bad option -n\n", progname);
+                return false;
+            }
+            continue;
+        case 'o':
+            hoistLoops = (optarg[0] == '+');
+            continue;
+        case 'x':
+            reduceOps = (optarg[0] == '+');
+            continue;
         case 'p':
             doPMD = (optarg[0] == '+');
             continue;
@@ -9330,7 +11423,7 @@ void initOptions(int argc, char **argv)
             curVal.i = strtoul(optarg, 0, 0);
             if (curVal.i > 9) {
                 fprintf(stderr, "%s: Bad option -s\n", progname);
-                exit(-1);
+                return false;
             }
             if (curVal.i == 3) {
                 lineCnt = 1;
@@ -9351,26 +11444,40 @@ void initOptions(int argc, char **argv)
             continue;
         case 'v':
             printf("%s\n", boilerplate);
-            exit(0);
+            status = 0;
+            return false;
         case 'V':
             ++verbose;
             continue;
+        case 'T':
+            showStats = true;
+            continue;
+        case 'S':
+            snapFileName = optarg;
+            continue;
+        case 'h':
+            usage();
+            status = 0;
+            return false;
         default:
             usage();
+            return false;
         }
         break;
     }
     argc -= optind;
     argv += optind;
-    if (argc < 1 || argc > 2)
+    if (argc < 1 || argc > 2) {
         usage();
+        return false;
+    }
 
-    // Open input file on stdin.
+    // Open input file, stdin by default.
     if (strcmp(argv[0], "-") != 0) {
-        if (freopen(argv[0], "r", stdin) == NULL) {
+        if ((pasinput = fopen(argv[0], "r")) == NULL) {
             fprintf(stderr, "%s: Cannot open input file\n", progname);
             perror(argv[0]);
-            exit(-1);
+            return false;
         }
     }
 
@@ -9379,9 +11486,12 @@ void initOptions(int argc, char **argv)
         outFileName = argv[1];
         unlink(outFileName);
     }
+    return true;
 } /* initOptions */
 
-int main(int argc, char **argv)
+// Sets up the tables and the predefined identifiers; the resulting state
+// does not depend on the options or the source.
+void initCompiler()
 {
     // Data Initializations moved here
     blockBegSys = Bits(LABELSY, CONSTSY, TYPESY, VARSY) + Bits(FUNCSY, PROCSY, BEGINSY);
@@ -9470,78 +11580,537 @@ int main(int argc, char **argv)
     setOpMap[MUL] = SETAND;
     setOpMap[RDIVOP] = SETXOR;
 
-    // Main program starts here
-
-    // L0 by default: no listing, only errors
-    PASINFOR.listMode = 0;
-    initOptions(argc, argv);
-    if (PASINFOR.listMode != 0)
-        printf("%s\n", boilerplate);
     curInsnTemplate = 0;
     initTables();
     litExternal = toText("EXTERNAL");
     litForward = toText("FORWARD");
     litFortran = toText("FORTRAN");
     litOct = toText("OCT");
-    PASINPUT = ugetc(pasinput);
+    initPredefined();
+} /* initCompiler */
+
+// The state built by initCompiler() can be kept in a file and loaded by
+// later runs instead. The heap objects refer to each other by native
+// pointers, which are relocated when loading; to find them, the heap is
+// built once more one word higher, and the words that move with it are
+// the pointers.
+
+// The saved globals; their addresses are those of the calling thread.
+struct SnapLayout {
+    struct Data { void * addr; size_t size; };
+    struct Ptrs { void ** addr; size_t count; };
+    std::vector<Data> data;
+    std::vector<Ptrs> ptrs;     // pointers into the heap, saved as offsets
+    SnapLayout();
+};
+
+#define SNAP(x) { &(x), sizeof(x) }
+#define SNAPP(x) { reinterpret_cast<void **>(&(x)), sizeof(x) / sizeof(void *) }
+SnapLayout::SnapLayout()
+{
+    Data d[] = {
+        SNAP(blockBegSys), SNAP(statBegSys), SNAP(statEndSys), SNAP(lvalOpSet),
+        SNAP(skipToSet), SNAP(bigSkipSet), SNAP(funcInsn), SNAP(charSymTabBase),
+        SNAP(chrClassTabBase), SNAP(iAddOpMap), SNAP(setOpMap), SNAP(iMulOpMap),
+        SNAP(FcstCnt), SNAP(FcstTotal), SNAP(frameRestore), SNAP(helperMap),
+        SNAP(InsnTemp), SNAP(indexreg), SNAP(jumpType), SNAP(opFlags),
+        SNAP(opToInsn), SNAP(opToMode), SNAP(koi2text), SNAP(curVal), SNAP(SY),
+        SNAP(charClass), SNAP(totalErrors), SNAP(heapCallsCnt), SNAP(putLeft),
+        SNAP(fetch), SNAP(curFrameRegTemplate), SNAP(curProcNesting),
+        SNAP(curInsnTemplate), SNAP(litExternal), SNAP(litForward),
+        SNAP(litFortran), SNAP(litOct), SNAP(strLen), SNAP(maxSmallString)
+    };
+    Ptrs p[] = {
+        SNAPP(symHashTabBase), SNAPP(typeHashTabBase),
+        SNAPP(smallStringType), SNAPP(numLabList), SNAPP(BooleanType),
+        SNAPP(IntegerType), SNAPP(CharType), SNAPP(RealType), SNAPP(setType),
+        SNAPP(pointerType), SNAPP(textType), SNAPP(AlfaType), SNAPP(uVarPtr),
+        SNAPP(uProcPtr)
+    };
+    data.assign(d, d + sizeof(d)/sizeof(d[0]));
+    ptrs.assign(p, p + sizeof(p)/sizeof(p[0]));
+}
+
+// A snapshot is only good for the very build that has written it.
+static std::string snapshotVersion()
+{
+    std::ostringstream ostr;
+    ostr << boilerplate << " snapshot, built " << __DATE__ << ' ' << __TIME__
+         << ", sizes " << sizeof(IdentRec) << ' ' << sizeof(Types)
+         << ' ' << sizeof(Expr) << '\n';
+    return ostr.str();
+}
+
+static bool snapRead(const std::string & buf, size_t & pos, void * to, size_t n)
+{
+    if (pos + n > buf.size())
+        return false;
+    memcpy(to, buf.data() + pos, n);
+    pos += n;
+    return true;
+}
+
+bool loadSnapshot(const char * name)
+{
+    FILE * f = fopen(name, "rb");
+    if (f == NULL)
+        return false;
+    std::string buf;
+    char chunk[65536];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+        buf.append(chunk, n);
+    fclose(f);
+
+    SnapLayout layout;
+    std::string version = snapshotVersion();
+    if (buf.compare(0, version.size(), version) != 0) {
+        if (verbose)
+            fprintf(stderr, "%s: Snapshot %s is stale, not using it\n", progname, name);
+        return false;
+    }
+    size_t pos = version.size();
+    int64_t base, size, nrelocs;
+    if (!snapRead(buf, pos, &base, sizeof(base)) ||
+        !snapRead(buf, pos, &size, sizeof(size)) ||
+        !snapRead(buf, pos, &nrelocs, sizeof(nrelocs)) ||
+        size < 100 || size > heapTop || nrelocs < 0 || nrelocs > size)
+        goto bad;
+    {
+        std::vector<int64_t> relocs(nrelocs);
+        if (!snapRead(buf, pos, relocs.data(), nrelocs * sizeof(int64_t)) ||
+            !snapRead(buf, pos, heap, size * sizeof(int64_t)))
+            goto bad;
+        avail = size;
+        int64_t delta = reinterpret_cast<int64_t>(heap) - base;
+        for (size_t i = 0; i < relocs.size(); ++i) {
+            if (relocs[i] < 100 || relocs[i] >= size)
+                goto bad;
+            heap[relocs[i]] += delta;
+        }
+    }
+    for (size_t i = 0; i < layout.data.size(); ++i)
+        if (!snapRead(buf, pos, layout.data[i].addr, layout.data[i].size))
+            goto bad;
+    for (size_t i = 0; i < layout.ptrs.size(); ++i) {
+        for (size_t j = 0; j < layout.ptrs[i].count; ++j) {
+            int64_t off;
+            if (!snapRead(buf, pos, &off, sizeof(off)) ||
+                (off != 074000 && (off < 0 || off >= avail)))
+                goto bad;
+            layout.ptrs[i].addr[j] = ptr(off);
+        }
+    }
+    {
+        int64_t len;
+        if (!snapRead(buf, pos, &len, sizeof(len)) || len < 0 || len > 1000)
+            goto bad;
+        CHILD.resize(len);
+        if (!snapRead(buf, pos, CHILD.data(), len * sizeof(int64_t)) ||
+            pos != buf.size())
+            goto bad;
+    }
+    return true;
+  bad:
+    fprintf(stderr, "%s: Snapshot %s is corrupt, not using it\n", progname, name);
+    clearHeap();
+    CHILD.clear();
+    return false;
+} /* loadSnapshot */
+
+// To be called right after initCompiler().
+void saveSnapshot(const char * name)
+{
+    std::vector<int64_t> image(heap, heap + avail), relocs;
+    int64_t size = avail;
+    bool ok;
+
+    clearHeap();
+    avail = 101;
+    initCompiler();
+    ok = avail == size + 1;
+    for (int64_t i = 100; ok && i < size; ++i) {
+        if (heap[i+1] == image[i])
+            continue;
+        if (heap[i+1] - image[i] == sizeof(int64_t) &&
+            image[i] >= reinterpret_cast<int64_t>(heap + 100) &&
+            image[i] <= reinterpret_cast<int64_t>(heap + size))
+            relocs.push_back(i);
+        else
+            ok = false;
+    }
+    clearHeap();
+    initCompiler();
+    if (!ok) {
+        fprintf(stderr, "%s: Cannot relocate the initial heap, no snapshot made\n", progname);
+        return;
+    }
+
+    // Written aside and renamed, for the concurrent runs
+    std::ostringstream tmpName;
+    tmpName << name << '.' << getpid() << '.' << std::this_thread::get_id();
+    FILE * f = fopen(tmpName.str().c_str(), "wb");
+    if (f == NULL) {
+        perror(tmpName.str().c_str());
+        return;
+    }
+    SnapLayout layout;
+    std::string version = snapshotVersion();
+    int64_t base = reinterpret_cast<int64_t>(heap), nrelocs = relocs.size();
+    fwrite(version.data(), version.size(), 1, f);
+    fwrite(&base, sizeof(base), 1, f);
+    fwrite(&size, sizeof(size), 1, f);
+    fwrite(&nrelocs, sizeof(nrelocs), 1, f);
+    fwrite(relocs.data(), sizeof(int64_t), nrelocs, f);
+    fwrite(heap, sizeof(int64_t), size, f);
+    for (size_t i = 0; i < layout.data.size(); ++i)
+        fwrite(layout.data[i].addr, layout.data[i].size, 1, f);
+    for (size_t i = 0; i < layout.ptrs.size(); ++i) {
+        for (size_t j = 0; j < layout.ptrs[i].count; ++j) {
+            int64_t off = ord(layout.ptrs[i].addr[j]);
+            fwrite(&off, sizeof(off), 1, f);
+        }
+    }
+    int64_t len = CHILD.size();
+    fwrite(&len, sizeof(len), 1, f);
+    fwrite(CHILD.data(), sizeof(int64_t), len, f);
+    if (fclose(f) != 0 || rename(tmpName.str().c_str(), name) != 0) {
+        perror(name);
+        unlink(tmpName.str().c_str());
+    }
+} /* saveSnapshot */
+
+// Brings all the compiler state to what it is at the program start,
+// so that several units can be compiled in one process.
+void resetState()
+{
+    clearHeap();
+    pasinput = stdin;
+    PASINPUT = 0;
+    srcText.clear();
+    srcPos = 0;
+    srcEOF = false;
+    eofCnt = 0;
+    outFileName = "output.obj";
+    snapFileName = NULL;
+
+    suffix = noSuffix;
+    bigSkipSet = statEndSys = blockBegSys = statBegSys = skipToSet = lvalOpSet = Bits();
+    bool47z = bool48z = bool49z = dataCheck = false;
+    jumpType = jumpTarget = int53z = 0;
+    charClass = MUL;
+    SY = prevSY = IDENT;
+    savedObjIdx = FcstCnt = symTabPos = entryPtCnt = fileBufSize = 0;
+    expr62z = expr63z = NULL;
+    curInsnTemplate = maxLineLen = linePos = prevErrPos = errsInLine = 0;
+    moduleOffset = lineStartOffset = curFrameRegTemplate = curProcNesting = 0;
+    totalErrors = lineCnt = bucket = strLen = heapCallsCnt = heapSize = arithMode = 0;
+    stmtName.clear();
+    curVarKind = kindReal;
+    curExternFile = NULL;
+    commentModeCH = 0;
+    CH = 0;
+    prevInsn.ii = 0;
+    debugLine = lineNesting = FcstTotal = objBufIdx = 0;
+    int92z = int93z = int94z = prevOpcode = charEncoding = int97z = 0;
+    atEOL = checkTypes = isDefined = putLeft = fetch = errors = false;
+    declExternal = rangeMismatch = doPMD = checkBounds = fuzzReals = false;
+    fixMult = bool110z = pseudoZ = allowCompat = checkFortran = hoistLoops = false;
+    verbose = 0;
+    showStats = false;
+    stats = Stats();
+    caseMode = 1;
+    loopRanges.clear();
+    inductionVars.clear();
+    reduceOps = threadCode = false;
+    loopHoists.clear();
+    inlineBodies.clear();
+    inlineNodes.clear();
+    inlinedHere.clear();
+    inlineCand = NULL;
+    inlineLimit = stmtCount = 0;
+    condLoopDepth = labelsSeen = 0;
+    upLevelVars.clear();
+    outputFile = inputFile = programObj = hashTravPtr = uProcPtr = NULL;
+    externFileList = NULL;
+    typ120z = typ121z = NULL;
+    pointerType = NULL;
+    setType = NULL;
+    BooleanType = IntegerType = CharType = NULL;
+    textType = NULL;
+    RealType = NULL;
+    AlfaType = NULL;
+    arg1Type = arg2Type = NULL;
+    numLabList = NULL;
+    chain = NULL;
+    curToken.ii = curVal.ii = 0;
+    leftInsn = curIdent = 0;
+    toAlloc = regsUsed = set146z = set147z = set148z = Bits();
+    optSflags.ii = 0;
+    litOct = litExternal = litForward = litFortran = 0;
+    uVarPtr = curExpr = NULL;
+    insnList = NULL;
+    fileForOutput = fileForInput = NULL;
+    maxSmallString = extSymAdornment = 0;
+    memset(smallStringType, 0, sizeof(smallStringType));
+    symTabMap.clear();
+    memset(iMulOpMap, 0, sizeof(iMulOpMap));
+    memset(setOpMap, 0, sizeof(setOpMap));
+    memset(iAddOpMap, 0, sizeof(iAddOpMap));
+    memset(entryPtTable, 0, sizeof(entryPtTable));
+    memset(frameRestore, 0, sizeof(frameRestore));
+    memset(indexreg, 0, sizeof(indexreg));
+    memset(opToInsn, 0, sizeof(opToInsn));
+    memset(opToMode, 0, sizeof(opToMode));
+    memset(opFlags, 0, sizeof(opFlags));
+    memset(funcInsn, 0, sizeof(funcInsn));
+    memset(InsnTemp, 0, sizeof(InsnTemp));
+    memset(lineBufBase, 0, sizeof(lineBufBase));
+    memset(errMapBase, 0, sizeof(errMapBase));
+    memset(chrClassTabBase, 0, sizeof(chrClassTabBase));
+    memset(charSymTabBase, 0, sizeof(charSymTabBase));
+    memset(symHashTabBase, 0, sizeof(symHashTabBase));
+    memset(typeHashTabBase, 0, sizeof(typeHashTabBase));
+    scopeLog.clear();
+    memset(helperMap, 0, sizeof(helperMap));
+    memset(symTab, 0, sizeof(symTab));
+    longSymTabBase.clear();
+    longSyms.clear();
+    longSymMap.clear();
+    litPool.clear();
+    memset(objBuffer, 0, sizeof(objBuffer));
+    memset(koi2text, 0, sizeof(koi2text));
+    FCST.clear();
+    CHILD.clear();
+    PASINFOR.listMode = PASINFOR.startOffset = 0;
+
+    // Left over if the previous unit was aborted
+    programme::super.clear();
+    parseComment::super = NULL;
+    typeCheck::super.clear();
+    formOperator::super.clear();
+    genFullExpr::super.clear();
+    parseTypeRef::super.clear();
+    parseRecordDecl::super.clear();
+    Statement::super.clear();
+} /* resetState */
+
+// Prints the report of -T. The time not taken by the other phases
+// is that of parsing, the declarations and the statements.
+void printStats(std::chrono::steady_clock::time_point start)
+{
+    double total = secondsSince(start);
+    int i;
+
+    countChains(symHashTabBase, stats.names, stats.nameChains);
+    countChains(typeHashTabBase, stats.types, stats.typeChains);
+    stats.parsing = total - stats.setup - stats.lexing - stats.codegen -
+        stats.finalize - stats.output;
+    fprintf(listing, " TIME: SETUP %.6f LEXING %.6f PARSING %.6f CODE %.6f"
+            " FINALIZE %.6f OBJECT %.6f TOTAL %.6f SEC\n",
+            stats.setup, stats.lexing, stats.parsing, stats.codegen,
+            stats.finalize, stats.output, total);
+    fprintf(listing, " TOKENS %ld IDENTIFIERS %ld LITERALS %ld SYMTAB ENTRIES %ld\n",
+            stats.tokens, stats.idents, stats.literals, stats.symbols);
+    fprintf(listing, " HEAP PEAK %ld WORDS, OBJECT BUFFER PEAK %ld OF %d WORDS\n",
+            availPeak, stats.objBufPeak, OBJBUF_SIZE);
+    fprintf(listing, " NAME HASH CHAINS AT %ld NAMES:", stats.names);
+    for (i = 0; i < CHAIN_HIST; ++i)
+        fprintf(listing, " %d%s:%ld", i, i == CHAIN_HIST - 1 ? "+" : "", stats.nameChains[i]);
+    fprintf(listing, "\n TYPE HASH CHAINS AT %ld TYPES:", stats.types);
+    for (i = 0; i < CHAIN_HIST; ++i)
+        fprintf(listing, " %d%s:%ld", i, i == CHAIN_HIST - 1 ? "+" : "", stats.typeChains[i]);
+    fprintf(listing, "\n");
+}
+
+// Compiles one unit; the arguments are as on the command line.
+// Returns the exit status.
+int compileArgs(int argc, char **argv, FILE * out)
+{
+    static std::mutex getoptMutex;
+    int status;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    resetState();
+    listing = out;
+
+    // Main program starts here
+
+    // L0 by default: no listing, only errors
+    PASINFOR.listMode = 0;
+    {
+        std::lock_guard<std::mutex> lock(getoptMutex);
+        optind = 1;
+        if (!initOptions(argc, argv, status))
+            return status;
+    }
+    if (PASINFOR.listMode != 0)
+        fprintf(listing, "%s\n", boilerplate);
+    if (snapFileName == NULL || !loadSnapshot(snapFileName)) {
+        initCompiler();
+        if (snapFileName != NULL)
+            saveSnapshot(snapFileName);
+    }
+    readSource();
+    PASINPUT = ugetc();
+    stats.setup = secondsSince(start);
     try {
         programme(curInsnTemplate, hashTravPtr);
     } catch (int foo) {
         if (foo == 9999) goto L9999;
     }
     if (errors) {
-L9999:  printf(" IN %ld LINES %ld ERRORS\n", lineCnt-1, totalErrors);
-        exit(1);
+L9999:  fprintf(listing, " IN %ld LINES %ld ERRORS\n", lineCnt-1, totalErrors);
+        if (showStats)
+            printStats(start);
+        return 1;
     } else {
         finalize();
-        // Dump CHILD here
-        FILE *f = fopen(outFileName, "w");
-        if (f == NULL) {
-            fprintf(stderr, "%s: Cannot open output file\n", progname);
-            perror(outFileName);
-            exit(-1);
-        }
-        fwrite("BESM6\0", 6, 1, f);
-        for (size_t i = 7; i < CHILD.size(); ++i) {
-            for (int j = 40; j >= 0; j -= 8)
-                fputc((CHILD[i] >> j) & 0xFF, f);
-        }
-        fclose(f);
-        exit(0);
-    }
-}
-
-int64_t resWordNameBase[30] = {
-        05441424554L             /*"   LABEL"*/,
-        04357566364L             /*"   CONST"*/,
-        064716045L               /*"    TYPE"*/,
-        0664162L                 /*"     VAR"*/,
-        04665564364515756L       /*"FUNCTION"*/,
-        06062574345446562L       /*"PROCEDUR"*/,
-        0634564L                 /*"     SET"*/,
-        0604143534544L           /*"  PACKED"*/,
-        04162624171L             /*"   ARRAY"*/,
-        0624543576244L           /*"  RECORD"*/,
-        046515445L               /*"    FILE"*/,
-        04245475156L             /*"   BEGIN"*/,
-        05146L                   /*"      IF"*/,
-        043416345L               /*"    CASE"*/,
-        0624560454164L           /*"  REPEAT"*/,
-        06750515445L             /*"   WHILE"*/,
-        0465762L                 /*"     FOR"*/,
-        067516450L               /*"    WITH"*/,
-        047576457L               /*"    GOTO"*/,
-        0455644L                 /*"     END"*/,
-        045546345L               /*"    ELSE"*/,
-        06556645154L             /*"   UNTIL"*/,
-        05746L                   /*"      OF"*/,
-        04457L                   /*"      DO"*/,
-        06457L                   /*"      TO"*/,
-        0445767566457L           /*"  DOWNTO"*/,
-        064504556L               /*"    THEN"*/,
-        0634554454364L           /*"  SELECT"*/,
-        060625747624155L         /*" PROGRAM"*/,
-        0576450456263L           /*"  OTHERS"*/};
+        {
+            PhaseTimer timer(stats.output);
+            // Dump CHILD here
+            FILE *f = fopen(outFileName, "w");
+            if (f == NULL) {
+                fprintf(stderr, "%s: Cannot open output file\n", progname);
+                perror(outFileName);
+                return -1;
+            }
+            fwrite("BESM6\0", 6, 1, f);
+            for (size_t i = 7; i < CHILD.size(); ++i) {
+                for (int j = 40; j >= 0; j -= 8)
+                    fputc((CHILD[i] >> j) & 0xFF, f);
+            }
+            fclose(f);
+        }
+        if (showStats)
+            printStats(start);
+        return 0;
+    }
+} /* compileArgs */
+
+// As compileArgs; the heap exhausted or corrupted fails only the unit,
+// the others of a batch going on with the heap cleared for them.
+int compileUnit(int argc, char **argv, FILE * out)
+{
+    try {
+        return compileArgs(argc, argv, out);
+    } catch (std::bad_alloc &) {
+    } catch (HeapError &) {
+    }
+    fprintf(stderr, "%s: Compilation abandoned\n", progname != NULL ? progname : argv[0]);
+    return 1;
+}
+
+// Compiles the units listed in a file, one per line, each line
+// holding the arguments as on the command line: [option...] infile [outfile].
+// Empty lines and lines starting with '#' are skipped.
+// With several jobs, the units are compiled concurrently, each thread
+// having its own compiler state; the listings are printed in the order
+// of the units when all are done. With report, each listing is followed
+// by the line " UNIT n: DONE|FAILED, t SEC", n counting from 1.
+// Returns the number of units that failed.
+int compileBatch(const char * self, const char * listName, int jobs, bool report)
+{
+    FILE * list = strcmp(listName, "-") ? fopen(listName, "r") : stdin;
+    if (list == NULL) {
+        fprintf(stderr, "%s: Cannot open batch file\n", progname);
+        perror(listName);
+        return -1;
+    }
+    std::vector<std::vector<std::string> > units;
+    char line[4096];
+    while (fgets(line, sizeof(line), list)) {
+        std::vector<std::string> args;
+        for (char * tok = strtok(line, " \t\r\n"); tok; tok = strtok(NULL, " \t\r\n"))
+            args.push_back(tok);
+        if (!args.empty() && args[0][0] != '#')
+            units.push_back(args);
+    }
+    if (list != stdin)
+        fclose(list);
+
+    std::vector<std::string> listings(units.size());
+    std::vector<int> status(units.size());
+    std::vector<double> seconds(units.size());
+    std::mutex next;
+    size_t nextUnit = 0;
+    auto worker = [&]() {
+        for (;;) {
+            size_t i;
+            {
+                std::lock_guard<std::mutex> lock(next);
+                if (nextUnit == units.size()) {
+                    freeHeap();
+                    return;
+                }
+                i = nextUnit++;
+            }
+            std::vector<char *> argv;
+            argv.push_back(const_cast<char *>(self));
+            for (size_t j = 0; j < units[i].size(); ++j)
+                argv.push_back(const_cast<char *>(units[i][j].c_str()));
+            argv.push_back(NULL);
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            if (jobs == 1) {
+                status[i] = compileUnit(argv.size() - 1, argv.data(), stdout);
+                seconds[i] = secondsSince(start);
+                if (report)
+                    printf(" UNIT %zu: %s, %.3f SEC\n", i + 1,
+                           status[i] ? "FAILED" : "DONE", seconds[i]);
+                fflush(stdout);
+            } else {
+                char * buf;
+                size_t len;
+                FILE * out = open_memstream(&buf, &len);
+                status[i] = compileUnit(argv.size() - 1, argv.data(), out);
+                seconds[i] = secondsSince(start);
+                fclose(out);
+                listings[i].assign(buf, len);
+                free(buf);
+            }
+        }
+    };
+    if (jobs == 1)
+        worker();
+    else {
+        std::vector<std::thread> threads;
+        for (int t = 0; t < jobs; ++t)
+            threads.push_back(std::thread(worker));
+        for (int t = 0; t < jobs; ++t)
+            threads[t].join();
+    }
+    int failed = 0;
+    for (size_t i = 0; i < units.size(); ++i) {
+        fputs(listings[i].c_str(), stdout);
+        if (report and jobs != 1)
+            printf(" UNIT %zu: %s, %.3f SEC\n", i + 1,
+                   status[i] ? "FAILED" : "DONE", seconds[i]);
+        if (status[i] != 0)
+            ++failed;
+    }
+    return failed;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc >= 3 && argc <= 5 && strcmp(argv[1], "-B") == 0) {
+        int jobs = 1;
+        bool report = false;
+        progname = strrchr(argv[0], '/');
+        progname = progname ? progname+1 : argv[0];
+        for (int i = 3; i < argc; ++i) {
+            if (strcmp(argv[i], "-T") == 0)
+                report = true;
+            else if (strncmp(argv[i], "-j", 2) != 0 ||
+                     (jobs = atoi(argv[i] + 2)) < 1) {
+                usage();
+                return -1;
+            }
+        }
+        return compileBatch(argv[0], argv[2], jobs, report) != 0;
+    }
+    return compileUnit(argc, argv, stdout);
+}
+
 #if 0
 // Non-ASCII chars ignored so far
     charSymTabBase['Ю'] := IDENT:31;
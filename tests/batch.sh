@@ -0,0 +1,30 @@
+#!/bin/sh
+# Compiles the test programs, with the default options and with all
+# the optimizations, by one pascompl -B list -j4 and by one pascompl
+# per unit, and compares the objects: the concurrent units must not
+# see each other's state.
+# Usage: tests/batch.sh [pascompl]
+PASCOMPL=${1:-./pascompl}
+dir=`mktemp -d`
+trap 'rm -rf $dir' 0
+status=0
+for src in tests/*.pas bench/*.pas; do
+    name=`basename $src .pas`
+    for opts in "" "-x+ -o+ -i16 -n0"; do
+        unit=$name`echo "$opts" | tr -d ' +-'`
+        echo "$opts $src $dir/$unit.b.obj" >> $dir/list
+        $PASCOMPL $opts $src $dir/$unit.s.obj > $dir/$unit.lst
+        echo $unit >> $dir/units
+    done
+done
+$PASCOMPL -B $dir/list -j4 > $dir/batch.lst
+for unit in `cat $dir/units`; do
+    if [ ! -f $dir/$unit.s.obj ]; then
+        echo "$unit: not compiled"
+        status=1
+    elif ! cmp $dir/$unit.s.obj $dir/$unit.b.obj; then
+        status=1
+    fi
+done
+[ $status = 0 ] && echo "batch: `wc -l < $dir/units` units ok"
+exit $status
@@ -0,0 +1,233 @@
+// The real arithmetic the compiler folds constants and reads literals
+// with, checked against known BESM-6 words and against the exact results
+// of a million random operations, rounded by the rules of the machine.
+// Built and run by make check.
+
+#define main pascompl_main
+#include "../pascompl.cc"
+#undef main
+
+#include <random>
+
+static int failures;
+
+static Real fromWord(uint64_t w)
+{
+    Real r;
+    r.mantissa = int64_t(w << 23) >> 23;
+    r.exponent = w >> 41;
+    return r;
+}
+
+static uint64_t toWord(Real r)
+{
+    return (uint64_t(r.exponent) << 41) | (uint64_t(r.mantissa) & ((1UL << 41) - 1));
+}
+
+static void expect(const char * what, bool ok, Real res, uint64_t want)
+{
+    if (not ok or toWord(res) != want) {
+        printf("%s: %s%016lo, expected %016lo\n", what,
+               ok ? "" : "trap, ", toWord(res), want);
+        ++failures;
+    }
+}
+
+static void expectTrap(const char * what, bool ok)
+{
+    if (ok) {
+        printf("%s: no trap\n", what);
+        ++failures;
+    }
+}
+
+// The known words: 1, -1, 1/2, 3, 2, 1/4, 1/3, 2/3, -1/3, 1/10, 10.
+const uint64_t ONE = 04050000000000000, MINUS_ONE = 04020000000000000,
+    HALF = 04010000000000000, THREE = 04114000000000000,
+    TWO = 04110000000000000, QUARTER = 03750000000000000,
+    THIRD = 03752525252525252, TWO_THIRDS = 04012525252525252,
+    MINUS_THIRD = 03765252525252525, TENTH = 03654631463146314,
+    TEN = 04212000000000000;
+
+static void knownWords()
+{
+    Real res, x;
+
+    expect("1 + 2", besm6Add(res, fromWord(ONE), fromWord(TWO), false), res, THREE);
+    expect("3 - 1", besm6Add(res, fromWord(THREE), fromWord(ONE), true), res, TWO);
+    expect("1 - 1", besm6Add(res, fromWord(ONE), fromWord(ONE), true), res, 0);
+    expect("-1 + 3", besm6Add(res, fromWord(MINUS_ONE), fromWord(THREE), false), res, TWO);
+    expect("1/10 + 1/10", besm6Add(res, fromWord(TENTH), fromWord(TENTH), false),
+           res, 03714631463146314);
+    // 2**-45 goes below the mantissa of 1 and sets its lowest bit
+    x.mantissa = 1L << 39;
+    x.exponent = 64 - 44;
+    expect("1 + 2**-45", besm6Add(res, fromWord(ONE), x, false), res, 04050000000000001);
+    expect("1/2 * 1/2", besm6Mul(res, fromWord(HALF), fromWord(HALF)), res, QUARTER);
+    expect("-1 * -1", besm6Mul(res, fromWord(MINUS_ONE), fromWord(MINUS_ONE)), res, ONE);
+    expect("1/3 * 3", besm6Mul(res, fromWord(THIRD), fromWord(THREE)), res, 04017777777777777);
+    expect("1/10 * 10", besm6Mul(res, fromWord(TENTH), fromWord(TEN)), res, 04017777777777777);
+    expect("0 * 3", besm6Mul(res, Real(), fromWord(THREE)), res, 0);
+    expect("1 / 3", besm6Div(res, fromWord(ONE), fromWord(THREE)), res, THIRD);
+    expect("2 / 3", besm6Div(res, fromWord(TWO), fromWord(THREE)), res, TWO_THIRDS);
+    expect("-1 / 3", besm6Div(res, fromWord(MINUS_ONE), fromWord(THREE)), res, MINUS_THIRD);
+    expect("1 / 10", besm6Div(res, fromWord(ONE), fromWord(TEN)), res, TENTH);
+    expectTrap("1 / 0", besm6Div(res, fromWord(ONE), Real()));
+    expect("round 2**80", besm6Round(res, __int128(1) << 80, 64, false), res, ONE);
+    x.mantissa = 1L << 39;
+    x.exponent = 127;
+    expectTrap("2**62 * 2**62", besm6Mul(res, x, x));
+    x.exponent = 1;
+    expect("2**-64 * 2**-64", besm6Mul(res, x, x), res, 0);
+    res = int64_t(10);
+    expect("integer 10", true, res, TEN);
+    res = int64_t(-1);
+    expect("integer -1", true, res, MINUS_ONE);
+    res = 0.0;
+    expect("double 0", true, res, 0);
+    res = -0.5;
+    expect("double -1/2", true, res, 03760000000000000);
+    res = 1e10;
+    expect("double 1e10", true, res, 06111240276200000);
+}
+
+// The exact result n * 2**scale, normalized, the mantissa taken
+// by the floor, its lowest bit set if round or if nonzero bits above
+// the lowest keep bits of n go below it; false on overflow.
+static bool reference(Real & res, __int128 n, int64_t scale, bool round, int64_t keep)
+{
+    __int128 mag = n < 0 ? ~n : n;
+    int64_t len = 0, shift;
+
+    if (n == 0) {
+        res = Real();
+        return true;
+    }
+    while (mag >> len)
+        ++len;
+    shift = len - 40;
+    if (shift > keep and ((n >> keep) & ((__int128(1) << (shift - keep)) - 1)) != 0)
+        round = true;
+    n = shift >= 0 ? n >> shift : n * (__int128(1) << -shift);
+    if (scale + shift + 104 < 0) {
+        res = Real();
+        return true;
+    }
+    if (scale + shift + 104 > 127)
+        return false;
+    res.mantissa = int64_t(n) | (round ? 1 : 0);
+    res.exponent = scale + shift + 104;
+    return true;
+}
+
+// The addend shifted right loses its bits below the mantissa of the
+// other, and so does the sum shifted right on the carry; either asks
+// for the rounding. The addend is kept exactly down to 42 more bits,
+// enough for the floor of a sum that is normalized by no more than
+// a bit unless the exponents are within one.
+static bool refAdd(Real & res, Real a, Real b, bool negate)
+{
+    int64_t ma = a.mantissa, mb = negate ? -int64_t(b.mantissa) : b.mantissa;
+    int64_t diff;
+
+    if (a.exponent < b.exponent) {
+        std::swap(a, b);
+        std::swap(ma, mb);
+    }
+    diff = a.exponent - b.exponent;
+    return reference(res, __int128(ma) * (1L << 42) +
+                     ((__int128(mb) * (1L << 42)) >> std::min(diff, 120L)),
+                     a.exponent - 104 - 42,
+                     diff <= 40 ? (mb & ((1L << diff) - 1)) != 0 : mb != 0, 42);
+}
+
+// The lower half of the 80-bit product asks for the rounding.
+static bool refMul(Real & res, Real a, Real b)
+{
+    __int128 prod = __int128(a.mantissa) * b.mantissa;
+
+    return reference(res, prod, int64_t(a.exponent) + b.exponent - 208,
+                     (prod < 0 ? -prod : prod) & ((__int128(1) << 40) - 1), 127);
+}
+
+// The quotient is truncated, not rounded.
+static bool refDiv(Real & res, Real a, Real b)
+{
+    __int128 num = __int128(a.mantissa) << 80, q;
+
+    if ((b.mantissa >> 39) == 0 or (b.mantissa >> 39) == -1)
+        return false;
+    q = num / b.mantissa;
+    if (num % b.mantissa != 0 and (num < 0) != (b.mantissa < 0))
+        --q;
+    return reference(res, q, int64_t(a.exponent) - b.exponent - 80, false, 127);
+}
+
+static Real randomReal(std::mt19937_64 & gen)
+{
+    uint64_t bits = gen();
+    Real r;
+
+    if ((bits & 0377) == 0)
+        return Real();
+    r.exponent = bits >> 57;
+    // Normalized: the bit below the sign differs from it
+    r.mantissa = int64_t(bits << 24) >> 24;
+    if ((r.mantissa >> 39) == 0)
+        r.mantissa = r.mantissa | (1L << 39);
+    else if ((r.mantissa >> 39) == -1)
+        r.mantissa = r.mantissa & ~(1L << 39);
+    return r;
+}
+
+static void compare(const char * op, Real a, Real b,
+                    bool ok, Real res, bool refOk, Real ref)
+{
+    if (ok != refOk or (ok and toWord(res) != toWord(ref))) {
+        if (failures < 20)
+            printf("%016lo %s %016lo: %016lo%s, expected %016lo%s\n",
+                   toWord(a), op, toWord(b), toWord(res), ok ? "" : " trap",
+                   toWord(ref), refOk ? "" : " trap");
+        ++failures;
+    }
+}
+
+static void randomOperands(int64_t count)
+{
+    std::mt19937_64 gen(1966);
+    Real a, b, res, ref;
+    bool ok, refOk;
+
+    for (int64_t i = 0; i < count; ++i) {
+        a = randomReal(gen);
+        b = randomReal(gen);
+        // Operands of close exponents half of the time; zero is
+        // all zeros, the exponent as well
+        if ((i & 1) and b.mantissa != 0)
+            b.exponent = std::min(127, std::max(0, int(a.exponent) + int(gen() % 90) - 45));
+        ok = besm6Add(res, a, b, false);
+        refOk = refAdd(ref, a, b, false);
+        compare("+", a, b, ok, res, refOk, ref);
+        ok = besm6Add(res, a, b, true);
+        refOk = refAdd(ref, a, b, true);
+        compare("-", a, b, ok, res, refOk, ref);
+        ok = besm6Mul(res, a, b);
+        refOk = refMul(ref, a, b);
+        compare("*", a, b, ok, res, refOk, ref);
+        ok = besm6Div(res, a, b);
+        refOk = refDiv(ref, a, b);
+        compare("/", a, b, ok, res, refOk, ref);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    knownWords();
+    randomOperands(argc > 1 ? atol(argv[1]) : 1000000);
+    if (failures != 0) {
+        printf("besm6arith: %d failed\n", failures);
+        return 1;
+    }
+    printf("besm6arith: ok\n");
+    return 0;
+}
@@ -0,0 +1,76 @@
+program divide(output);
+{ The integer division by constants, as compiled with -x+ and without:
+  a power of two divides a dividend known not to be negative by the
+  exponent; any other dividend goes through the usual division.
+  Prints the failed quotients and the count of the checks passed. }
+const big = 1099511627775;      { 2**40 - 1 }
+      half = 549755813888;      { 2**39 }
+type natural = 0..big;
+var n: natural; i, x, passed, fails: integer;
+
+procedure check(x, d, q: integer);
+var r: integer;
+begin
+  r := x - q * d;
+  if (x >= 0) and ((r < 0) or (r >= d)) or
+     (x < 0) and ((r > 0) or (r <= -d)) then begin
+    writeln(' ', x, ' div ', d, ' =', q, ' failed');
+    fails := fails + 1
+  end else
+    passed := passed + 1
+end;
+
+procedure checkNatural;
+begin
+  check(n, 1, n div 1);
+  check(n, 2, n div 2);
+  check(n, 4, n div 4);
+  check(n, 1024, n div 1024);
+  check(n, half, n div half);
+  check(n, 3, n div 3)
+end;
+
+procedure checkSigned;
+begin
+  check(x, 1, x div 1);
+  check(x, 2, x div 2);
+  check(x, 4, x div 4);
+  check(x, 1024, x div 1024);
+  check(x, half, x div half);
+  check(x, 3, x div 3)
+end;
+
+begin
+  passed := 0;
+  fails := 0;
+  { A ranged loop variable, from zero over the first powers }
+  for i := 0 to 40 do begin
+    check(i, 2, i div 2);
+    check(i, 4, i div 4);
+    check(i, 8, i div 8);
+    check(i, 32, i div 32)
+  end;
+  { Negative, unknown to be so at compile time }
+  for i := -40 to -1 do begin
+    x := i;
+    check(x, 2, x div 2);
+    check(x, 8, x div 8)
+  end;
+  { The boundaries of the 41-bit integers }
+  n := 0; checkNatural;
+  n := 1; checkNatural;
+  n := 1023; checkNatural;
+  n := 1024; checkNatural;
+  n := half - 1; checkNatural;
+  n := half; checkNatural;
+  n := big - 1; checkNatural;
+  n := big; checkNatural;
+  x := 0; checkSigned;
+  x := -1; checkSigned;
+  x := -1024; checkSigned;
+  x := -1025; checkSigned;
+  x := -half; checkSigned;
+  x := -big; checkSigned;
+  x := big; checkSigned;
+  writeln(' divide:', passed, ' passed,', fails, ' failed')
+end.
@@ -0,0 +1,97 @@
+program tokens(output);
+{ The text of loops as read ahead for -o+ (scanLoop) must be lexed as
+  the compiler lexes it: each loop sums a[1..10] through a[j], j being
+  stepped after a token that holds "end;" or brackets in its text.
+  Should the assignment of j be missed, a[j] would be kept for the
+  whole loop. Prints the loops that got the wrong sum. }
+const sum = 385;
+var a: array [1..20] of integer;
+    k, fails: integer;
+    t: alfa;
+
+procedure check(s, n: integer);
+begin
+  if s <> sum then begin
+    writeln(' loop', n, ' failed:', s);
+    fails := fails + 1
+  end
+end;
+
+procedure run;
+var i, s: integer; j, m: 1..20;
+begin
+  { A brace comment }
+  j := 1; s := 0;
+  for i := 1 to 10 do begin
+    s := s + a[j];
+    { end; a[j] (* }
+    j := j + 1
+  end;
+  check(s, 1);
+  { A parenthesis-star comment, closed either way }
+  j := 1; s := 0;
+  for i := 1 to 10 do begin
+    s := s + a[j];
+    (* end; { 'a *)
+    (* end; *}
+    j := j + 1
+  end;
+  check(s, 2);
+  { Strings, with a doubled quote }
+  j := 1; s := 0;
+  for i := 1 to 10 do begin
+    s := s + a[j];
+    t := 'end;{ ';
+    if t <> 'it''s; ' then
+      j := j + 1
+  end;
+  check(s, 3);
+  { A line starting with % }
+  j := 1; s := 0;
+  for i := 1 to 10 do begin
+    s := s + a[j];
+%   end; { '
+    j := j + 1
+  end;
+  check(s, 4);
+  { Index brackets as (. and .) }
+  j := 1; m := 1; s := 0;
+  for i := 1 to 10 do begin
+    s := s + a(.j.);
+    j := a(.m.) + j
+  end;
+  check(s, 5);
+  { Keywords opening and closing statements }
+  j := 1; s := 0;
+  for i := 1 to 10 do begin
+    s := s + a[j];
+    case i mod 2 of
+    0: begin k := 0 end;
+    1: repeat k := 1 until true
+    end;
+    j := j + 1
+  end;
+  check(s, 6);
+  { The columns past 120 }
+  j := 1; s := 0;
+  for i := 1 to 10 do begin
+    s := s + a[j];                                                                                                       end; j := 1
+    j := j + 1
+  end;
+  check(s, 7);
+  { A while loop }
+  j := 1; s := 0;
+  while j <= 10 do begin
+    s := s + a[j];
+    { end. }
+    j := j + 1
+  end;
+  check(s, 8)
+end;
+
+begin
+  fails := 0;
+  for k := 1 to 20 do a[k] := k * k;
+  run;
+  writeln(' tokens:', fails, ' failed')
+end.